@@ -0,0 +1,87 @@
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <autodiff.hpp>
+
+
+using namespace ASC_ode;
+
+
+// potential energy of a hanging chain in 2D: masses at (x[2i], x[2i+1]),
+// the first one tied to the origin, springs of length 1 and stiffness k
+template <typename T>
+T ChainEnergy (const std::vector<T> & x, double k)
+{
+  size_t nm = x.size()/2;
+  T energy = 0.0;
+  T px = 0.0, py = 0.0;
+  for (size_t i = 0; i < nm; i++)
+    {
+      T dx = x[2*i]-px;
+      T dy = x[2*i+1]-py;
+      T r = sqrt(dx*dx+dy*dy);
+      T stretch = r - 1.0;
+      energy += 0.5*k * stretch*stretch;
+      energy += 9.81 * x[2*i+1];
+      px = x[2*i];
+      py = x[2*i+1];
+    }
+  return energy;
+}
+
+
+constexpr size_t nmasses = 8;
+constexpr size_t N = 2*nmasses;
+
+// gradient of the energy by forward AutoDiff, one pass with N derivatives
+std::vector<double> ForwardGradient (const std::vector<double> & xval, double k)
+{
+  std::vector<AutoDiff<N>> x;
+  for (size_t i = 0; i < N; i++)
+    {
+      AutoDiff<N> xi(xval[i]);
+      xi.deriv()[i] = 1.0;
+      x.push_back(xi);
+    }
+  AutoDiff<N> energy = ChainEnergy(x, k);
+  std::vector<double> grad(N);
+  for (size_t i = 0; i < N; i++)
+    grad[i] = energy.deriv()[i];
+  return grad;
+}
+
+
+int main()
+{
+  std::vector<double> xval(N);
+  for (size_t i = 0; i < nmasses; i++)
+    {
+      xval[2*i] = 0.9*(i+1) + 0.05*std::sin(double(i));
+      xval[2*i+1] = -0.1*(i+1)*(i+1);
+    }
+
+  // the variables are recorded once, both energies are evaluated from
+  // the checkpoint after them
+  Tape tape;
+  std::vector<RevAD> x;
+  for (double v : xval)
+    x.push_back(tape.variable(v));
+  size_t start = tape.checkpoint();
+
+  for (double k : { 100.0, 1000.0 })
+    {
+      tape.rewind(start);
+      RevAD energy = ChainEnergy(x, k);
+      tape.gradient(energy);
+
+      auto grad = ForwardGradient(xval, k);
+      double err = 0;
+      for (size_t i = 0; i < N; i++)
+        err = std::max(err, std::abs(tape.adjoint(x[i]) - grad[i]) / std::max(1.0, std::abs(grad[i])));
+
+      std::cout << "k = " << k << ": energy " << energy.value()
+                << ", tape nodes " << tape.size()
+                << ", gradient reverse vs forward " << err << std::endl;
+    }
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <sparse_autodiff.hpp>
+
+
+using namespace ASC_ode;
+
+
+// f = Laplace(u) + lambda exp(u) by the 5-point stencil on an n x n grid
+// with zero boundary values (Bratu problem), at most 5 nonzeros per row
+class Bratu
+{
+  size_t m_n;
+  double m_lambda;
+public:
+  Bratu (size_t n, double lambda) : m_n(n), m_lambda(lambda) { }
+
+  size_t dimX() const { return m_n*m_n; }
+  size_t dimF() const { return m_n*m_n; }
+
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    double h = 1.0 / (m_n+1);
+    double hinv2 = 1/(h*h);
+    for (size_t j = 0; j < m_n; j++)
+      for (size_t i = 0; i < m_n; i++)
+        {
+          size_t k = j*m_n+i;
+          T lap = -4.0 * x(k);
+          if (i > 0) lap += x(k-1);
+          if (i+1 < m_n) lap += x(k+1);
+          if (j > 0) lap += x(k-m_n);
+          if (j+1 < m_n) lap += x(k+m_n);
+          f(k) = hinv2 * lap + m_lambda * exp(x(k));
+        }
+  }
+};
+
+
+int main()
+{
+  // all columns of the Jacobian against central differences
+  {
+    auto bratu = std::make_shared<Bratu>(20, 2.0);
+    SparseADFunction<Bratu> func(bratu);
+    size_t n = func.dimX();
+    Vector<> x(n), f(n), fp(n), fm(n), col(n);
+    for (size_t i = 0; i < n; i++)
+      x(i) = 0.3*std::sin(0.1*i);
+
+    SparseMatrix jac;
+    func.evaluateSparseDeriv(x, f, jac);
+
+    double eps = 1e-6, err = 0, scale = 0;
+    for (size_t j = 0; j < n; j++)
+      {
+        double xj = x(j);
+        x(j) = xj + eps; func.evaluate(x, fp);
+        x(j) = xj - eps; func.evaluate(x, fm);
+        x(j) = xj;
+        col = 0.0;
+        for (size_t i = 0; i < n; i++)
+          for (size_t k = jac.firstInRow(i); k < jac.firstInRow(i+1); k++)
+            if (jac.colIndex(k) == j) col(i) = jac.value(k);
+        for (size_t i = 0; i < n; i++)
+          {
+            err = std::max(err, std::abs((fp(i)-fm(i))/(2*eps) - col(i)));
+            scale = std::max(scale, std::abs(col(i)));
+          }
+      }
+    std::cout << "unknowns " << n << ", nonzeros " << jac.nnz()
+              << ", relative error vs central differences " << err/scale << std::endl;
+  }
+
+  // one Jacobian of a 1e5 unknown stencil
+  {
+    auto bratu = std::make_shared<Bratu>(316, 2.0);
+    SparseADFunction<Bratu> func(bratu);
+    size_t n = func.dimX();
+    Vector<> x(n), f(n);
+    for (size_t i = 0; i < n; i++)
+      x(i) = 0.3*std::sin(0.1*i);
+
+    SparseMatrix jac;
+    func.evaluateSparseDeriv(x, f, jac);
+    int runs = 10;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < runs; r++)
+      func.evaluateSparseDeriv(x, f, jac);
+    double t = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count() / runs;
+    std::cout << "unknowns " << n << ", nonzeros " << jac.nnz()
+              << ", " << 1000*t << " ms per Jacobian" << std::endl;
+  }
+}
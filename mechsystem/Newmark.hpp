@@ -1,6 +1,8 @@
 #ifndef NEWMARK_HPP
 #define NEWMARK_HPP
 
+#include <stdexcept>
+
 #include <nonlinfunc.hpp>
 
 
@@ -10,14 +12,20 @@
   // Newmark and generalized alpha:
   // https://miaodi.github.io/finite%20element%20method/newmark-generalized/
 
-  // Newmark method for  mass*d^2x/dt^2 = rhs
+  // full integrator state after a step: t, x, dx, ddx (e.g. for checkpoints)
+  using StateCallback = std::function<void(double,VectorView<double>,VectorView<double>,VectorView<double>)>;
+
+
+  // Newmark method for  mass*d^2x/dt^2 = rhs  on [t0, tend]
+  // a diagonal mass (IdentityFunction, DiagonalFunction) is applied by scaling
   void SolveODE_Newmark(double tend, int steps,
                         VectorView<double> x, VectorView<double> dx,
                         std::shared_ptr<NonlinearFunction> rhs,
                         std::shared_ptr<NonlinearFunction> mass,
-                        std::function<void(double,VectorView<double>)> callback = nullptr)
+                        std::function<void(double,VectorView<double>)> callback = nullptr,
+                        double t0 = 0.0, StateCallback statecallback = nullptr)
   {
-    double dt = tend/steps;
+    double dt = (tend-t0)/steps;
     double gamma = 0.5;
     double beta = 0.25;
 
@@ -28,6 +36,11 @@
     auto vold = std::make_shared<ConstantFunction>(dx);
     auto aold = std::make_shared<ConstantFunction>(x);
     rhs->evaluate (xold->get(), aold->get());
+    // M a = rhs, cheap to solve for a diagonal mass matrix
+    Vector<> mdiag(x.size());
+    if (mass->evaluateDiagDeriv(x, mdiag))
+      for (size_t i = 0; i < mdiag.size(); i++)
+        if (mdiag(i) != 0) aold->get()(i) /= mdiag(i);
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
     auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
@@ -35,7 +48,7 @@
 
     auto equ = Compose(mass, anew) - Compose(rhs, xnew);
 
-    double t = 0;
+    double t = t0;
     for (int i = 0; i < steps; i++)
       {
         NewtonSolver (equ, a);
@@ -47,6 +60,7 @@
         aold->set(a);
         t += dt;
         if (callback) callback(t, x);
+        if (statecallback) statecallback(t, x, v, a);
       }
     dx = v;
   }
@@ -54,14 +68,75 @@
 
 
 
-  // Generalized alpha method for M d^2x/dt^2 = rhs
+  // Central difference method (leapfrog / velocity Verlet) for  mass*d^2x/dt^2 = rhs
+  // on [t0, tend]. Explicit: one rhs evaluation per step, no Jacobian and no linear solve.
+  // Needs a diagonal mass matrix, and is only stable for dt < 2/omega_max,
+  // see CriticalTimeStep for mass-spring systems.
+  // ddx returns the final acceleration.
+  void SolveODE_CentralDifference(double tend, int steps,
+                                  VectorView<double> x, VectorView<double> dx,
+                                  VectorView<double> ddx,
+                                  std::shared_ptr<NonlinearFunction> rhs,
+                                  std::shared_ptr<NonlinearFunction> mass,
+                                  std::function<void(double,VectorView<double>)> callback = nullptr,
+                                  double t0 = 0.0, StateCallback statecallback = nullptr)
+  {
+    double dt = (tend-t0)/steps;
+
+    Vector<> a(x.size());
+    Vector<> minv(x.size());
+    if (!mass->evaluateDiagDeriv(x, minv))
+      throw std::invalid_argument("central difference needs a diagonal mass matrix");
+    for (size_t i = 0; i < minv.size(); i++)
+      {
+        if (minv(i) == 0)
+          throw std::invalid_argument("central difference needs a regular mass matrix");
+        minv(i) = 1.0/minv(i);
+      }
+
+    auto acceleration = [&] ()
+    {
+      rhs->evaluate(x, a);
+      for (size_t i = 0; i < a.size(); i++)
+        a(i) *= minv(i);
+    };
+
+    acceleration();
+    double t = t0;
+    for (int i = 0; i < steps; i++)
+      {
+        dx += dt/2 * a;
+        x += dt * dx;
+        acceleration();
+        dx += dt/2 * a;
+
+        t += dt;
+        if (callback) callback(t, x);
+        if (statecallback) statecallback(t, x, dx, a);
+      }
+    ddx = a;
+  }
+
+
+
+
+  // Generalized alpha method for M d^2x/dt^2 = rhs(x; p)  on [t0, tend],
+  // together with the sensitivities dxdp = dx/dp and dvdp = dv/dp (n x P)
+  // of the P parameters, dfdp gives d rhs/dp. Per step, after Newton,
+  // the Jacobian of the step equation at the new acceleration is factored
+  // once and solved for all P columns (staggered direct method), about the
+  // cost of one Newton iteration instead of P more simulations.
+  // The mass matrix must be regular and independent of p.
   void SolveODE_Alpha (double tend, int steps, double rhoinf,
                        VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
+                       MatrixView<double> dxdp, MatrixView<double> dvdp,
                        std::shared_ptr<NonlinearFunction> rhs,
+                       const ParameterDerivative & dfdp,
                        std::shared_ptr<NonlinearFunction> mass,
-                       std::function<void(double,VectorView<double>)> callback = nullptr)
+                       std::function<void(double,VectorView<double>)> callback = nullptr,
+                       double t0 = 0.0, StateCallback statecallback = nullptr)
   {
-    double dt = tend/steps;
+    double dt = (tend-t0)/steps;
     double alpham = (2*rhoinf-1)/(rhoinf+1);
     double alphaf = rhoinf/(rhoinf+1);
     double gamma = 0.5-alpham+alphaf;
@@ -82,7 +157,34 @@
     // auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - Compose(rhs, (1-alphaf)*xnew+alphaf*xold);
     auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold);
 
-    double t = 0;
+    // sensitivities: dadp, and g = f_x dxdp + f_p at the old x
+    size_t np = dxdp.cols();
+    Matrix<> dadp(x.size(), np), g(x.size(), np), fp(x.size(), np);
+    Vector<> xt(x.size()), s(x.size()), ms(x.size());
+    auto sensitivityRhs = [&] (VectorView<double> xx, MatrixView<double> dxx)
+    {
+      dfdp(xx, fp);
+      Linearization jac(rhs, xx);
+      for (size_t j = 0; j < np; j++)
+        {
+          jac.mult(dxx.col(j), g.col(j));
+          g.col(j) += fp.col(j);
+        }
+    };
+    if (np > 0)
+      {
+        // M dadp = f_x dxdp + f_p
+        sensitivityRhs(x, dxdp);
+        Linearization m(mass, ddx);
+        for (size_t j = 0; j < np; j++)
+          {
+            s = g.col(j);
+            m.solve(s);
+            dadp.col(j) = s;
+          }
+      }
+
+    double t = t0;
     a = ddx;
 
     for (int i = 0; i < steps; i++)
@@ -91,17 +193,61 @@
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
+        if (np > 0)
+          {
+            //  equ'(a) dadp_new = (1-af) (f_x(xnew) xt + f_p(xnew)) + af g - am M dadp,
+            //  xt = dxdp + dt dvdp + dt^2/2 (1-2beta) dadp  the part of dxdp_new without dadp_new
+            dfdp(x, fp);
+            Linearization jacf(rhs, x);
+            Linearization m(mass, a);
+            Linearization jac(equ, a);
+            for (size_t j = 0; j < np; j++)
+              {
+                xt = dxdp.col(j) + dt * dvdp.col(j) + (dt*dt/2*(1-2*beta)) * dadp.col(j);
+                jacf.mult(xt, s);
+                s *= 1-alphaf;
+                s += (1-alphaf) * fp.col(j) + alphaf * g.col(j);
+                m.mult(dadp.col(j), ms);
+                s -= alpham * ms;
+                jac.solve(s);
+
+                dxdp.col(j) = xt + (dt*dt*beta) * s;
+                dvdp.col(j) += dt * ((1-gamma) * dadp.col(j) + gamma * s);
+                dadp.col(j) = s;
+                // g at the new x
+                jacf.mult(dxdp.col(j), g.col(j));
+                g.col(j) += fp.col(j);
+              }
+          }
+
         xold->set(x);
         vold->set(v);
         aold->set(a);
         t += dt;
         if (callback) callback(t, x);
+        if (statecallback) statecallback(t, x, v, a);
       }
     dx = v;
     ddx = a;
   }
 
 
+  // Generalized alpha method for M d^2x/dt^2 = rhs  on [t0, tend].
+  // x, dx, ddx and t are the complete state, so a run restarted from a
+  // checkpoint continues exactly.
+  void SolveODE_Alpha (double tend, int steps, double rhoinf,
+                       VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
+                       std::shared_ptr<NonlinearFunction> rhs,
+                       std::shared_ptr<NonlinearFunction> mass,
+                       std::function<void(double,VectorView<double>)> callback = nullptr,
+                       double t0 = 0.0, StateCallback statecallback = nullptr)
+  {
+    Matrix<> nosens(x.size(), 0);
+    SolveODE_Alpha (tend, steps, rhoinf, x, dx, ddx, nosens, nosens, rhs, nullptr, mass,
+                    callback, t0, statecallback);
+  }
+
+
 
 
 
@@ -5,12 +5,16 @@
 
 #include "mass_spring.hpp"
 #include "Newmark.hpp"
+#include "equilibrium.hpp"
+#include "mss_constraints.hpp"
+#include "xpbd.hpp"
 
 namespace py = pybind11;
 
 PYBIND11_MAKE_OPAQUE(std::vector<Mass<3>>);
 PYBIND11_MAKE_OPAQUE(std::vector<Fix<3>>);
-PYBIND11_MAKE_OPAQUE(std::vector<Spring>);
+PYBIND11_MAKE_OPAQUE(std::vector<Spring<>>);
+PYBIND11_MAKE_OPAQUE(std::vector<DistanceConstraint<>>);
 
 PYBIND11_MODULE(mass_spring, m) {
     m.doc() = "mass-spring-system simulator";
@@ -67,16 +71,23 @@ PYBIND11_MODULE(mass_spring, m) {
 
     py::class_<Connector> (m, "Connector");
 
-    py::class_<Spring> (m, "Spring")
+    py::class_<Spring<>> (m, "Spring")
       .def(py::init<double, double, std::array<Connector,2>>())
       .def_property_readonly("connectors",
-                             [](Spring & s) { return s.connectors; })
+                             [](Spring<> & s) { return s.connectors; })
       ;
 
 
     py::bind_vector<std::vector<Mass<3>>>(m, "Masses3d");
     py::bind_vector<std::vector<Fix<3>>>(m, "Fixes3d");
-    py::bind_vector<std::vector<Spring>>(m, "Springs");
+    py::class_<DistanceConstraint<>> (m, "DistanceConstraint")
+      .def(py::init<double, std::array<Connector,2>>())
+      .def_property_readonly("connectors",
+                             [](DistanceConstraint<> & c) { return c.connectors; })
+      ;
+
+    py::bind_vector<std::vector<Spring<>>>(m, "Springs");
+    py::bind_vector<std::vector<DistanceConstraint<>>>(m, "DistanceConstraints");
 
 
     py::class_<MassSpringSystem<2>> (m, "MassSpringSystem2d")
@@ -94,13 +105,23 @@ PYBIND11_MODULE(mass_spring, m) {
       })
       .def_property("gravity", [](MassSpringSystem<3> & mss) { return mss.getGravity(); },
                     [](MassSpringSystem<3> & mss, std::array<double,3> g) { mss.setGravity(Vec<3>{g[0],g[1],g[2]}); })
+      .def("renumber_masses", [](MassSpringSystem<3> & mss) { mss.renumberMasses(); })
+      .def("set_contact", [](MassSpringSystem<3> & mss, double radius, double stiffness) {
+        mss.setContact(radius, stiffness); })
       .def("add", [](MassSpringSystem<3> & mss, Mass<3> m) { return mss.addMass(m); })
       .def("add", [](MassSpringSystem<3> & mss, Fix<3> f) { return mss.addFix(f); })
-      .def("add", [](MassSpringSystem<3> & mss, Spring s) { return mss.addSpring(s); })
+      .def("add", [](MassSpringSystem<3> & mss, Spring<> s) { return mss.addSpring(s); })
+      .def("add", [](MassSpringSystem<3> & mss, DistanceConstraint<> c) { return mss.addConstraint(c); })
       .def_property_readonly("masses", [](MassSpringSystem<3> & mss) -> auto& { return mss.masses(); })
       .def_property_readonly("fixes", [](MassSpringSystem<3> & mss) -> auto& { return mss.fixes(); })
-      .def_property_readonly("springs", [](MassSpringSystem<3> & mss) -> auto& { return mss.springs(); })
-      .def("__getitem__", [](MassSpringSystem<3> mss, Connector & c) {
+      // copies: adding, removing or rewiring goes through add / set_spring_*
+      .def_property_readonly("springs", [](const MassSpringSystem<3> & mss) { return mss.springs(); })
+      .def_property_readonly("constraints", [](const MassSpringSystem<3> & mss) { return mss.constraints(); })
+      .def("set_spring_stiffness", [](MassSpringSystem<3> & mss, size_t s, double k) {
+        mss.setSpringStiffness(s, k); })
+      .def("set_spring_length", [](MassSpringSystem<3> & mss, size_t s, double l) {
+        mss.setSpringLength(s, l); })
+      .def("__getitem__", [](const MassSpringSystem<3> & mss, Connector & c) {
         if (c.type==Connector::FIX) return py::cast(mss.fixes()[c.nr]);
         else return py::cast(mss.masses()[c.nr]);
       })
@@ -125,7 +146,46 @@ PYBIND11_MODULE(mass_spring, m) {
         SolveODE_Alpha(tend, steps, 0.8, x, dx, ddx, mss_func, mass);
 
         mss.setState (x, dx, ddx);
-    });
+    })
+      .def("simulate_explicit", [](MassSpringSystem<3> & mss, double tend, double safety) {
+        Vector<> x(3*mss.masses().size());
+        Vector<> dx(3*mss.masses().size());
+        Vector<> ddx(3*mss.masses().size());
+        mss.getState (x, dx, ddx);
+
+        auto mss_func = std::make_shared<MSS_Function<3>> (mss);
+        auto mass = std::make_shared<IdentityFunction> (x.size());
+
+        int steps = StableTimeSteps(mss, tend, safety);
+        SolveODE_CentralDifference(tend, steps, x, dx, ddx, mss_func, mass);
+
+        mss.setState (x, dx, ddx);
+        return steps;
+      }, py::arg("tend"), py::arg("safety")=0.9)
+      .def("simulate_rattle", [](MassSpringSystem<3> & mss, double tend, size_t steps) {
+        Vector<> x(3*mss.masses().size());
+        Vector<> dx(3*mss.masses().size());
+        Vector<> ddx(3*mss.masses().size());
+        mss.getState (x, dx, ddx);
+
+        SolveODE_RATTLE(tend, steps, x, dx, ddx, mss);
+
+        mss.setState (x, dx, ddx);
+      })
+      .def("simulate_xpbd", [](MassSpringSystem<3> & mss, double tend, size_t frames,
+                               int substeps, int iterations) {
+        Vector<> x(3*mss.masses().size());
+        Vector<> dx(3*mss.masses().size());
+        Vector<> ddx(3*mss.masses().size());
+        mss.getState (x, dx, ddx);
+
+        SolveODE_XPBD(tend, frames, x, dx, ddx, mss, substeps, iterations);
+
+        mss.setState (x, dx, ddx);
+      }, py::arg("tend"), py::arg("frames"), py::arg("substeps")=10, py::arg("iterations")=1)
+      .def("solve_static", [](MassSpringSystem<3> & mss, int loadsteps) {
+        return SolveStatic(mss, loadsteps);
+      }, py::arg("loadsteps")=10);
 
 
 
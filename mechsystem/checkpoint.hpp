@@ -0,0 +1,315 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ASC_HAVE_MMAP
+#endif
+
+#include "mass_spring.hpp"
+
+
+// Binary checkpoint of a MassSpringSystem together with the integrator
+// state (t, x, dx, ddx). The state is stored in the masses (pos, vel, acc),
+// so after ReadCheckpoint, getState returns exactly the saved vectors.
+//
+// Layout, native byte order:
+//   CheckpointHeader
+//   fixes:    nfixes * D doubles
+//   masses:   nmasses * (1+3D) doubles     mass, pos, vel, acc
+//   springs:  nsprings * CheckpointSpring
+//   dofnr:    ndofnr uint64                empty if not renumbered
+
+constexpr uint32_t checkpoint_version = 1;
+
+struct CheckpointHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t dim;
+  uint64_t nfixes, nmasses, nsprings, ndofnr;
+  double time;
+  double gravity[3];
+  double contactradius, contactstiffness;
+};
+
+struct CheckpointSpring
+{
+  double length, stiffness;
+  uint64_t type[2], nr[2];
+};
+
+constexpr char checkpoint_magic[8] = { 'A', 'S', 'C', 'M', 'S', 'S', 0, 0 };
+
+
+// Writes to filename.tmp first and renames, so a crash while writing
+// never destroys the previous checkpoint.
+template <int D>
+void WriteCheckpoint (const std::string & filename, const MassSpringSystem<D> & mss, double t,
+                      VectorView<double> x, VectorView<double> dx, VectorView<double> ddx)
+{
+  auto & fixes = mss.fixes();
+  auto & masses = mss.masses();
+  auto & springs = mss.springs();
+  auto & dofnr = mss.dofNumbers();
+  if (!mss.constraints().empty())
+    throw std::invalid_argument("WriteCheckpoint: distance constraints are not supported");
+
+  CheckpointHeader header { };
+  std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+  header.version = checkpoint_version;
+  header.dim = D;
+  header.nfixes = fixes.size();
+  header.nmasses = masses.size();
+  header.nsprings = springs.size();
+  header.ndofnr = dofnr.size();
+  header.time = t;
+  for (int d = 0; d < D; d++)
+    header.gravity[d] = mss.getGravity()(d);
+  header.contactradius = mss.getContactRadius();
+  header.contactstiffness = mss.getContactStiffness();
+
+  std::vector<double> fixdata(D*fixes.size());
+  for (size_t i = 0; i < fixes.size(); i++)
+    for (int d = 0; d < D; d++)
+      fixdata[i*D+d] = fixes[i].pos(d);
+
+  constexpr size_t mwidth = 1+3*D;
+  std::vector<double> massdata(mwidth*masses.size());
+  for (size_t i = 0; i < masses.size(); i++)
+    {
+      double * rec = &massdata[i*mwidth];
+      size_t dof = mss.dofNr(i);
+      rec[0] = masses[i].mass;
+      for (int d = 0; d < D; d++)
+        {
+          rec[1+d] = x(dof*D+d);
+          rec[1+D+d] = dx(dof*D+d);
+          rec[1+2*D+d] = ddx(dof*D+d);
+        }
+    }
+
+  std::vector<CheckpointSpring> springdata(springs.size());
+  for (size_t s = 0; s < springs.size(); s++)
+    {
+      springdata[s].length = springs[s].length;
+      springdata[s].stiffness = springs[s].stiffness;
+      for (int k = 0; k < 2; k++)
+        {
+          springdata[s].type[k] = springs[s].connectors[k].type;
+          springdata[s].nr[k] = springs[s].connectors[k].nr;
+        }
+    }
+
+  std::vector<uint64_t> dofdata(dofnr.begin(), dofnr.end());
+
+  std::string tmpname = filename + ".tmp";
+  FILE * file = std::fopen(tmpname.c_str(), "wb");
+  if (!file)
+    throw std::runtime_error("cannot open checkpoint file " + tmpname);
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = ok && std::fwrite(fixdata.data(), sizeof(double), fixdata.size(), file) == fixdata.size();
+  ok = ok && std::fwrite(massdata.data(), sizeof(double), massdata.size(), file) == massdata.size();
+  ok = ok && std::fwrite(springdata.data(), sizeof(CheckpointSpring), springdata.size(), file) == springdata.size();
+  ok = ok && std::fwrite(dofdata.data(), sizeof(uint64_t), dofdata.size(), file) == dofdata.size();
+  ok = (std::fclose(file) == 0) && ok;
+  if (!ok || std::rename(tmpname.c_str(), filename.c_str()) != 0)
+    throw std::runtime_error("writing checkpoint " + filename + " failed");
+}
+
+
+// read-only view of a whole file, memory mapped where available
+class MappedFile
+{
+  const char * m_data = nullptr;
+  size_t m_size = 0;
+  std::vector<char> m_buffer;
+public:
+  MappedFile (const std::string & filename)
+  {
+#ifdef ASC_HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("cannot open " + filename);
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+      {
+        ::close(fd);
+        throw std::runtime_error("cannot stat " + filename);
+      }
+    m_size = st.st_size;
+    if (m_size > 0)
+      {
+        void * p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+          {
+            ::close(fd);
+            throw std::runtime_error("cannot map " + filename);
+          }
+        m_data = static_cast<const char*>(p);
+      }
+    ::close(fd);
+#else
+    FILE * file = std::fopen(filename.c_str(), "rb");
+    if (!file)
+      throw std::runtime_error("cannot open " + filename);
+    std::fseek(file, 0, SEEK_END);
+    m_buffer.resize(std::ftell(file));
+    std::fseek(file, 0, SEEK_SET);
+    m_size = std::fread(m_buffer.data(), 1, m_buffer.size(), file);
+    std::fclose(file);
+    m_data = m_buffer.data();
+#endif
+  }
+
+  ~MappedFile ()
+  {
+#ifdef ASC_HAVE_MMAP
+    if (m_data)
+      ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+  }
+
+  MappedFile (const MappedFile &) = delete;
+  MappedFile & operator= (const MappedFile &) = delete;
+
+  const char * data() const { return m_data; }
+  size_t size() const { return m_size; }
+};
+
+
+// Replaces mss by the checkpointed system and returns the time.
+// The state is afterwards available by mss.getState(x, dx, ddx).
+template <int D>
+double ReadCheckpoint (const std::string & filename, MassSpringSystem<D> & mss)
+{
+  MappedFile file(filename);
+  size_t pos = 0;
+  auto read = [&] (void * dst, size_t bytes)
+  {
+    if (pos + bytes > file.size())
+      throw std::runtime_error("checkpoint " + filename + " is truncated");
+    std::memcpy(dst, file.data()+pos, bytes);
+    pos += bytes;
+  };
+
+  CheckpointHeader header;
+  read(&header, sizeof(header));
+  if (std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0)
+    throw std::runtime_error(filename + " is not a mass-spring checkpoint");
+  if (header.version != checkpoint_version)
+    throw std::runtime_error("checkpoint " + filename + " has unsupported version "
+                             + std::to_string(header.version));
+  if (header.dim != D)
+    throw std::runtime_error("checkpoint " + filename + " has dimension "
+                             + std::to_string(header.dim));
+
+  constexpr size_t mwidth = 1+3*D;
+  size_t expected = sizeof(header) + sizeof(double) * (D*header.nfixes + mwidth*header.nmasses)
+    + sizeof(CheckpointSpring)*header.nsprings + sizeof(uint64_t)*header.ndofnr;
+  if (file.size() != expected || (header.ndofnr != 0 && header.ndofnr != header.nmasses))
+    throw std::runtime_error("checkpoint " + filename + " has wrong size");
+
+  MassSpringSystem<D> newmss;
+  Vec<D> gravity;
+  for (int d = 0; d < D; d++)
+    gravity(d) = header.gravity[d];
+  newmss.setGravity(gravity);
+  newmss.setContact(header.contactradius, header.contactstiffness);
+
+  for (size_t i = 0; i < header.nfixes; i++)
+    {
+      double rec[D];
+      read(rec, sizeof(rec));
+      Fix<D> fix;
+      for (int d = 0; d < D; d++)
+        fix.pos(d) = rec[d];
+      newmss.addFix(fix);
+    }
+
+  for (size_t i = 0; i < header.nmasses; i++)
+    {
+      double rec[mwidth];
+      read(rec, sizeof(rec));
+      Mass<D> mass;
+      mass.mass = rec[0];
+      for (int d = 0; d < D; d++)
+        {
+          mass.pos(d) = rec[1+d];
+          mass.vel(d) = rec[1+D+d];
+          mass.acc(d) = rec[1+2*D+d];
+        }
+      newmss.addMass(mass);
+    }
+
+  for (size_t s = 0; s < header.nsprings; s++)
+    {
+      CheckpointSpring rec;
+      read(&rec, sizeof(rec));
+      Spring<> spring { rec.length, rec.stiffness, { } };
+      for (int k = 0; k < 2; k++)
+        {
+          auto type = Connector::CONTYPE(rec.type[k]);
+          size_t limit = (type == Connector::FIX) ? header.nfixes : header.nmasses;
+          if ((type != Connector::FIX && type != Connector::MASS) || rec.nr[k] >= limit)
+            throw std::runtime_error("checkpoint " + filename + " has an invalid spring");
+          spring.connectors[k] = { type, size_t(rec.nr[k]) };
+        }
+      newmss.addSpring(spring);
+    }
+
+  if (header.ndofnr)
+    {
+      std::vector<uint64_t> dofdata(header.ndofnr);
+      read(dofdata.data(), sizeof(uint64_t)*dofdata.size());
+      // must be a permutation of 0...nmasses-1
+      std::vector<bool> used(header.nmasses, false);
+      for (auto nr : dofdata)
+        {
+          if (nr >= header.nmasses || used[nr])
+            throw std::runtime_error("checkpoint " + filename + " has invalid dof numbers");
+          used[nr] = true;
+        }
+      newmss.setDofNumbers(std::vector<size_t>(dofdata.begin(), dofdata.end()));
+    }
+
+  mss = std::move(newmss);
+  return header.time;
+}
+
+
+// Writes a checkpoint whenever another interval of simulated time has
+// passed, use it as state callback of SolveODE_Alpha, SolveODE_Newmark
+// or SolveODE_CentralDifference.
+template <int D>
+class CheckpointWriter
+{
+  std::string m_filename;
+  const MassSpringSystem<D> & m_mss;
+  double m_interval;
+  double m_next;
+public:
+  CheckpointWriter (std::string filename, const MassSpringSystem<D> & mss,
+                    double interval, double t0 = 0.0)
+    : m_filename(std::move(filename)), m_mss(mss), m_interval(interval), m_next(t0+interval) { }
+
+  void operator() (double t, VectorView<double> x, VectorView<double> dx, VectorView<double> ddx)
+  {
+    if (t < m_next - 1e-9*m_interval) return;
+    WriteCheckpoint(m_filename, m_mss, t, x, dx, ddx);
+    while (m_next <= t + 1e-9*m_interval)
+      m_next += m_interval;
+  }
+};
+
+#endif // CHECKPOINT_HPP
@@ -0,0 +1,67 @@
+// Checkpoint round trip: a run on [0,4] writes checkpoints with
+// CheckpointWriter, a second run restarts from the checkpoint at t = 2
+// (ReadCheckpoint) and has to end in the same state, up to round-off:
+// the checkpoint time is the sum of the steps, not exactly 2. Done for the
+// generalized alpha method and for central differences.
+//
+//   checkpoint_check [output_dir]
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include "checkpoint.hpp"
+#include "mss_generators.hpp"
+#include "Newmark.hpp"
+
+constexpr int D = 2;
+
+template <typename SOLVE>
+bool RoundTrip (const std::string & name, const std::string & filename, SOLVE solve)
+{
+  auto mss = MakeCrane<D>(8);
+  mss.setGravity(MakePoint<D>(0, -9.81));
+  mss.renumberMasses();
+  size_t n = D*mss.masses().size();
+
+  Vector<> x(n), v(n), a(n);
+  mss.getState(x, v, a);
+  auto rhs = std::make_shared<MSS_Function<D>>(mss);
+  CheckpointWriter<D> writer(filename, mss, 1.0);
+  solve(2.0, x, v, a, rhs, 0.0, writer);
+  solve(4.0, x, v, a, rhs, 2.0, nullptr);
+
+  MassSpringSystem<D> restarted;
+  double t = ReadCheckpoint(filename, restarted);
+  Vector<> x2(n), v2(n), a2(n);
+  restarted.getState(x2, v2, a2);
+  auto rhs2 = std::make_shared<MSS_Function<D>>(restarted);
+  solve(4.0, x2, v2, a2, rhs2, t, nullptr);
+
+  double diff = 0;
+  for (size_t i = 0; i < n; i++)
+    diff = std::max({ diff, std::abs(x(i)-x2(i)), std::abs(v(i)-v2(i)) });
+  std::printf("%-8s restart at t = %g, difference after restart %g\n", name.c_str(), t, diff);
+  std::remove(filename.c_str());
+  return std::abs(t-2.0) < 1e-9 && diff < 1e-10;
+}
+
+int main (int argc, char * argv[])
+{
+  std::string output_dir = (argc > 1) ? argv[1] : ".";
+  auto mass = [] (size_t n) { return std::make_shared<IdentityFunction>(n); };
+
+  bool ok = RoundTrip("alpha", output_dir + "/checkpoint_alpha.bin",
+                      [&] (double tend, VectorView<double> x, VectorView<double> v, VectorView<double> a,
+                           std::shared_ptr<NonlinearFunction> rhs, double t0, StateCallback state)
+                      {
+                        SolveODE_Alpha(tend, 200, 0.8, x, v, a, rhs, mass(x.size()), nullptr, t0, state);
+                      });
+  ok &= RoundTrip("central", output_dir + "/checkpoint_central.bin",
+                  [&] (double tend, VectorView<double> x, VectorView<double> v, VectorView<double> a,
+                       std::shared_ptr<NonlinearFunction> rhs, double t0, StateCallback state)
+                  {
+                    SolveODE_CentralDifference(tend, 2000, x, v, a, rhs, mass(x.size()), nullptr, t0, state);
+                  });
+  return ok ? 0 : 1;
+}
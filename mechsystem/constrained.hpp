@@ -0,0 +1,183 @@
+#ifndef CONSTRAINED_HPP
+#define CONSTRAINED_HPP
+
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+
+#include <nonlinfunc.hpp>
+#include <sparsematrix.hpp>
+
+using namespace ASC_ode;
+
+
+// Mechanical system with holonomic constraints g(q) = 0:
+//
+//   M q'' = f(q) - G(q)^T lambda,    G = dg/dq
+//
+// Positions and Lagrange multipliers are kept apart, M is diagonal and
+// G is stored by sparse rows, one row per constraint.
+class ConstrainedSystem
+{
+public:
+  virtual ~ConstrainedSystem() = default;
+  virtual size_t dimQ() const = 0;   // number of positions
+  virtual size_t dimC() const = 0;   // number of constraints = multipliers
+  virtual void massDiag (VectorView<double> m) const = 0;
+  virtual void forces (VectorView<double> q, VectorView<double> f) const = 0;
+  virtual void constraints (VectorView<double> q, VectorView<double> g) const = 0;
+  virtual void constraintJacobian (VectorView<double> q, SparseMatrix & G) const = 0;
+};
+
+
+// Solves the Schur complement system  G diag(minv) G^T y = b
+// matrix-free by Jacobi-preconditioned conjugate gradients.
+// Every iteration costs O(nnz(G)). reg > 0 adds reg * diag(S), which
+// keeps the system regular for redundant constraints.
+inline void SolveSchurCG (const SparseMatrix & G, VectorView<double> minv,
+                          VectorView<double> b, VectorView<double> y,
+                          double tol = 1e-14, int maxsteps = 1000, double reg = 0.0)
+{
+  size_t m = G.rows();
+  Vector<> r(m), z(m), p(m), Sp(m), diag(m), precond(m), tmpq(G.cols());
+
+  for (size_t i = 0; i < m; i++)
+    {
+      diag(i) = 0;
+      for (size_t k = G.firstInRow(i); k < G.firstInRow(i+1); k++)
+        diag(i) += G.value(k)*G.value(k) * minv(G.colIndex(k));
+      precond(i) = diag(i) > 0 ? 1.0/((1+reg)*diag(i)) : 1.0;
+    }
+
+  auto applyS = [&] (VectorView<double> v, VectorView<double> Sv)
+  {
+    G.multTrans(v, tmpq);
+    for (size_t j = 0; j < tmpq.size(); j++)
+      tmpq(j) *= minv(j);
+    G.mult(tmpq, Sv);
+    if (reg > 0)
+      for (size_t i = 0; i < m; i++)
+        Sv(i) += reg*diag(i)*v(i);
+  };
+
+  y = 0.0;
+  r = b;
+  for (size_t i = 0; i < m; i++) z(i) = precond(i)*r(i);
+  p = z;
+  double rz = 0;
+  for (size_t i = 0; i < m; i++) rz += r(i)*z(i);
+  double rz0 = rz;
+
+  for (int it = 0; it < maxsteps && rz > tol*tol*rz0 && rz > 0; it++)
+    {
+      applyS(p, Sp);
+      double pSp = 0;
+      for (size_t i = 0; i < m; i++) pSp += p(i)*Sp(i);
+      double alpha = rz / pSp;
+      y += alpha*p;
+      r -= alpha*Sp;
+      for (size_t i = 0; i < m; i++) z(i) = precond(i)*r(i);
+      double rznew = 0;
+      for (size_t i = 0; i < m; i++) rznew += r(i)*z(i);
+      p *= rznew/rz;
+      p += z;
+      rz = rznew;
+    }
+}
+
+
+
+// Generalized alpha method for the constrained system
+//
+//   (1-am) M a + am M aold = (1-af) f(xnew) + af f(xold) - G(xnew)^T lambda
+//   g(xnew) = 0
+//
+// Newton iterations on (a, lambda) use the saddle point matrix
+// [ (1-am)M  G^T ; G  0 ] and eliminate the accelerations with the diagonal
+// mass, so only the constraint Schur complement G M^{-1} G^T is solved.
+// The stiffness of f and the curvature of the constraints are dropped from
+// the iteration matrix, the cost per iteration is O(n + nnz(G)).
+void SolveConstrained_Alpha (double tend, int steps, double rhoinf,
+                             VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
+                             VectorView<double> lambda,
+                             const ConstrainedSystem & sys,
+                             std::function<void(double,VectorView<double>,VectorView<double>)> callback = nullptr,
+                             double tol = 1e-10, int maxsteps = 50)
+{
+  double dt = tend/steps;
+  double alpham = (2*rhoinf-1)/(rhoinf+1);
+  double alphaf = rhoinf/(rhoinf+1);
+  double gamma = 0.5-alpham+alphaf;
+  double beta = 0.25 * (1-alpham+alphaf)*(1-alpham+alphaf);
+
+  size_t n = sys.dimQ();
+  size_t m = sys.dimC();
+
+  Vector<> mass(n), minv(n);
+  sys.massDiag(mass);
+  for (size_t i = 0; i < n; i++)
+    minv(i) = 1.0 / ((1-alpham)*mass(i));
+
+  Vector<> xold(n), vold(n), aold(n), fold(n), a(n);
+  Vector<> fnew(n), r1(n), r2(m), rhs(m), dlam(m), tmpq(n), tmpc(m);
+  SparseMatrix G(n);
+
+  xold = x;
+  vold = dx;
+  aold = ddx;
+  a = ddx;
+
+  double t = 0;
+  for (int i = 0; i < steps; i++)
+    {
+      sys.forces(xold, fold);
+
+      bool converged = false;
+      for (int it = 0; it < maxsteps; it++)
+        {
+          x = xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold + 2*beta*a);
+
+          sys.forces(x, fnew);
+          sys.constraints(x, r2);
+          sys.constraintJacobian(x, G);
+
+          G.multTrans(lambda, tmpq);
+          for (size_t j = 0; j < n; j++)
+            r1(j) = mass(j) * ((1-alpham)*a(j) + alpham*aold(j))
+              - (1-alphaf)*fnew(j) - alphaf*fold(j) + tmpq(j);
+          r2 *= 1.0/(beta*dt*dt);
+
+          if (norm(r1) + norm(r2) < tol)
+            {
+              converged = true;
+              break;
+            }
+
+          // S dlam = G Meff^{-1} r1 - r2
+          for (size_t j = 0; j < n; j++)
+            tmpq(j) = minv(j)*r1(j);
+          G.mult(tmpq, rhs);
+          rhs -= r2;
+          SolveSchurCG(G, minv, rhs, dlam);
+
+          // da = Meff^{-1} (r1 - G^T dlam)
+          G.multTrans(dlam, tmpq);
+          for (size_t j = 0; j < n; j++)
+            a(j) -= minv(j)*(r1(j)-tmpq(j));
+          lambda -= dlam;
+        }
+      if (!converged)
+        throw std::domain_error("Newton did not converge");
+
+      dx = vold + dt*((1-gamma)*aold + gamma*a);
+
+      xold = x;
+      vold = dx;
+      aold = a;
+      t += dt;
+      if (callback) callback(t, x, lambda);
+    }
+  ddx = a;
+}
+
+#endif // CONSTRAINED_HPP
@@ -0,0 +1,221 @@
+#ifndef EQUILIBRIUM_HPP
+#define EQUILIBRIUM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include <inverse.hpp>
+#include "mass_spring.hpp"
+
+
+// Potential energy of springs, contacts and gravity, x is the state vector
+template <int D>
+double PotentialEnergy (const MassSpringSystem<D> & mss, VectorView<double> x)
+{
+  auto & cmss = mss.compiled();
+  auto coord = [&] (size_t node, int d)
+  { return node < cmss.nmasses ? x(node*D+d) : cmss.fixpos[d][node-cmss.nmasses]; };
+
+  double energy = 0;
+  for (size_t s = 0; s < cmss.nsprings(); s++)
+    {
+      double r2 = 0;
+      for (int d = 0; d < D; d++)
+        {
+          double diff = coord(cmss.node2[s], d) - coord(cmss.node1[s], d);
+          r2 += diff*diff;
+        }
+      double stretch = std::sqrt(r2) - cmss.length[s];
+      energy += 0.5 * cmss.stiffness[s] * stretch*stretch;
+    }
+  Vec<D> gravity = mss.getGravity();
+  for (size_t i = 0; i < cmss.nmasses; i++)
+    for (int d = 0; d < D; d++)
+      energy -= gravity(d) * x(i*D+d) / cmss.invmass[i];
+  if (mss.getContactRadius() > 0)
+    energy += MSS_Function<D>(mss).contactEnergy(x);
+  return energy;
+}
+
+
+// Static equilibrium  f(x) = 0  of a mass-spring system, f = MSS_Function.
+//
+// Gravity is applied in load steps, starting with 1/loadsteps of the load.
+// Every load level is solved by Newton with the exact Jacobian (banded LU
+// for narrow banded systems, see renumberMasses) and a backtracking line
+// search on the potential energy. Failed levels are retried with half the
+// load increment. If the stiffness is singular or indefinite, e.g. for a
+// straight chain without tension, the Jacobian is shifted (Levenberg-
+// Marquardt) until the Newton direction decreases the energy.
+//
+// Convergence is |f| <= tol |g| sqrt(#masses). On success the masses are
+// moved to the equilibrium with zero velocity and acceleration, so
+// getState returns the starting point for a dynamic run.
+// Returns the total number of Newton steps. Distance constraints are
+// not supported.
+template <int D>
+int SolveStatic (MassSpringSystem<D> & mss, int loadsteps = 10,
+                 double tol = 1e-10, int maxsteps = 100)
+{
+  if (!std::as_const(mss).constraints().empty())
+    throw std::invalid_argument("SolveStatic: distance constraints are not supported");
+
+  size_t nm = mss.masses().size();
+  size_t n = D*nm;
+  Vector<> x(n), v(n), a(n);
+  mss.getState(x, v, a);
+  if (n == 0) return 0;
+
+  MSS_Function<D> func(mss);
+  Vec<D> gravity = mss.getGravity();
+  double scale = norm(gravity) * std::sqrt(double(nm));
+  double abstol = tol * (scale > 0 ? scale : 1.0);
+
+  size_t bw = func.bandwidth();
+  bool banded = UseBandedJacobian(func);
+  BandMatrix bandjac(banded ? n : 0, bw);
+  // band not available after all: dense
+  if (banded && !func.evaluateBandDeriv(x, bandjac))
+    banded = false;
+  Matrix<> densejac(banded ? 0 : n, banded ? 0 : n);
+
+  Vector<> f(n), dx(n), xtrial(n), ftrial(n), mass(n);
+  auto & cmss = mss.compiled();
+  for (size_t i = 0; i < n; i++)
+    mass(i) = 1.0 / cmss.invmass[i/D];
+  double jscale = 0;   // largest diagonal entry of the Jacobian
+
+  // dx = (J - mu I)^{-1} f,  false if singular
+  auto newtonDirection = [&] (double mu) -> bool
+  {
+    if (banded && !func.evaluateBandDeriv(x, bandjac))
+      throw std::logic_error("SolveStatic: band Jacobian not available");
+    try
+      {
+        dx = f;
+        jscale = 0;
+        if (banded)
+          {
+            for (size_t i = 0; i < n; i++)
+              {
+                jscale = std::max(jscale, std::abs(bandjac(i,i)));
+                bandjac(i,i) -= mu;
+              }
+            bandjac.factor();
+            bandjac.solve(dx);
+          }
+        else
+          {
+            func.evaluateDeriv(x, densejac);
+            for (size_t i = 0; i < n; i++)
+              {
+                jscale = std::max(jscale, std::abs(densejac(i,i)));
+                densejac(i,i) -= mu;
+              }
+            calcInverse(densejac);
+            dx = densejac * f;
+          }
+      }
+    catch (std::exception &)
+      {
+        return false;
+      }
+    for (size_t i = 0; i < n; i++)
+      if (!std::isfinite(dx(i))) return false;
+    return true;
+  };
+
+  // Newton with line search at the current load, false if it stalls
+  int steps = 0;
+  double mu = 0;
+  auto solveLevel = [&] () -> bool
+  {
+    for (int it = 0; it < maxsteps; it++, steps++)
+      {
+        func.evaluate(x, f);
+        double err = norm(f);
+        if (err <= abstol)
+          return true;
+
+        bool accepted = false;
+        double energy = PotentialEnergy(mss, x);
+        for (int shift = 0; shift < 30 && !accepted; shift++)
+          {
+            // slope of the energy along -dx is  (M f) . dx
+            double slope = 0;
+            if (newtonDirection(mu))
+              for (size_t i = 0; i < n; i++)
+                slope += mass(i) * f(i) * dx(i);
+
+            // backtracking line search, Armijo on the energy; close to the
+            // solution energy differences drown in round-off, then a
+            // smaller residual is accepted as well
+            if (slope < 0)
+              for (double alpha = 1; alpha > 1e-4; alpha /= 2)
+                {
+                  xtrial = x - alpha*dx;
+                  func.evaluate(xtrial, ftrial);
+                  if (PotentialEnergy(mss, xtrial) <= energy + 1e-4*alpha*slope
+                      || norm(ftrial) < 0.5*err)
+                    {
+                      x = xtrial;
+                      accepted = true;
+                      break;
+                    }
+                }
+            if (accepted)
+              mu = (mu > 1e-10*jscale) ? mu/10 : 0.0;
+            else
+              mu = std::max(4*mu, 1e-8*std::max(jscale, 1.0));
+          }
+        if (!accepted)
+          return false;
+      }
+    return false;
+  };
+
+  // load stepping, the increment is halved when a level fails
+  // and doubled again after easy levels
+  Vector<> xconverged = x;
+  double load = 0, increment = 1.0 / loadsteps;
+  try
+    {
+      while (load < 1)
+        {
+          double next = std::min(1.0, load + increment);
+          mss.setGravity(next * gravity);
+          int before = steps;
+          if (solveLevel())
+            {
+              load = next;
+              xconverged = x;
+              if (steps - before < 5)
+                increment *= 2;
+            }
+          else
+            {
+              x = xconverged;
+              mu = 0;
+              increment /= 2;
+              if (increment < 1e-6)
+                throw std::domain_error("SolveStatic: no equilibrium found beyond load factor "
+                                        + std::to_string(load));
+            }
+        }
+    }
+  catch (...)
+    {
+      mss.setGravity(gravity);
+      throw;
+    }
+  mss.setGravity(gravity);
+
+  v = 0.0;
+  a = 0.0;
+  mss.setState(x, v, a);
+  return steps;
+}
+
+#endif // EQUILIBRIUM_HPP
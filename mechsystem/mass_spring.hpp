@@ -1,8 +1,19 @@
 #ifndef MASS_SPRING_HPP
 #define MASS_SPRING_HPP
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
 #include <nonlinfunc.hpp>
+#include <autodiff.hpp>
 #include <timestepper.hpp>
+#include <taskmanager.hpp>
+#include <simd.hpp>
+#include <skylinematrix.hpp>
+#include "spatial_hash.hpp"
 
 using namespace ASC_ode;
 
@@ -10,22 +21,24 @@ using namespace ASC_ode;
 using namespace nanoblas;
 
 
-template <int D>
+// T is the scalar type of the system: double, float for ensemble
+// throughput, or AutoDiff for derivatives with respect to parameters
+template <int D, typename T = double>
 class Mass
 {
 public:
-  double mass;
-  Vec<D> pos;
-  Vec<D> vel = 0.0;
-  Vec<D> acc = 0.0;
+  T mass;
+  Vec<D,T> pos;
+  Vec<D,T> vel = T(0.0);
+  Vec<D,T> acc = T(0.0);
 };
 
 
-template <int D>
+template <int D, typename T = double>
 class Fix
 {
 public:
-  Vec<D> pos;
+  Vec<D,T> pos;
 };
 
 
@@ -43,48 +56,460 @@ std::ostream & operator<< (std::ostream & ost, const Connector & con)
   return ost;
 }
 
+template <typename T = double>
 class Spring
 {
 public:
-  double length;
-  double stiffness;
+  T length;
+  T stiffness;
   std::array<Connector,2> connectors;
 };
 
-template <int D>
+// rigid rod: the distance of the connectors is kept at length by a
+// Lagrange multiplier instead of a stiff spring, see mss_constraints.hpp
+template <typename T = double>
+class DistanceConstraint
+{
+public:
+  T length;
+  std::array<Connector,2> connectors;
+};
+
+template <int D, typename T> class MassSpringSystem;
+
+// Flat copy of a MassSpringSystem for the force and Jacobian loops.
+// Nodes [0,nmasses) are the masses in state (dof) order, the fixes follow as ghost nodes with
+// inverse mass 0, so springs need no FIX/MASS branch. Spring end points
+// are contiguous index arrays, node->spring adjacency is stored as CSR.
+// Springs are stored color by color, springs of one color share no mass.
+template <int D, typename T = double>
+class CompiledMSS
+{
+public:
+  size_t nmasses = 0;
+  size_t nnodes = 0;
+  std::vector<T> invmass;                      // per node, 0 for fixes
+  std::array<std::vector<T>,D> fixpos;         // fix coordinates by component
+  std::vector<size_t> node1, node2;            // spring end points
+  std::vector<T> length, stiffness;
+  std::vector<size_t> firstspring, adjsprings; // springs at node i: adjsprings[firstspring[i]...]
+  std::vector<size_t> firstincolor;             // color c: springs [firstincolor[c], firstincolor[c+1])
+  std::vector<size_t> springindex;              // compiled spring -> index in MassSpringSystem
+  size_t bandwidth = 0;                         // max |node1-node2| of springs between masses
+  std::vector<size_t> cnode1, cnode2;           // distance constraints, in MassSpringSystem order
+  std::vector<T> clength;
+
+  size_t nsprings() const { return node1.size(); }
+  size_t nconstraints() const { return cnode1.size(); }
+
+  void compile (const MassSpringSystem<D,T> & mss)
+  {
+    auto & masses = mss.masses();
+    auto & fixes = mss.fixes();
+    auto & springs = mss.springs();
+
+    nmasses = masses.size();
+    nnodes = nmasses + fixes.size();
+
+    invmass.resize(nnodes);
+    for (size_t i = 0; i < nmasses; i++)
+      invmass[mss.dofNr(i)] = T(1.0) / masses[i].mass;
+    for (size_t i = nmasses; i < nnodes; i++)
+      invmass[i] = T(0.0);
+
+    for (int d = 0; d < D; d++)
+      {
+        fixpos[d].resize(fixes.size());
+        for (size_t i = 0; i < fixes.size(); i++)
+          fixpos[d][i] = fixes[i].pos(d);
+      }
+
+    auto node = [&] (Connector c) { return c.type == Connector::FIX ? nmasses+c.nr : mss.dofNr(c.nr); };
+    size_t ns = springs.size();
+    node1.resize(ns);
+    node2.resize(ns);
+    length.resize(ns);
+    stiffness.resize(ns);
+    for (size_t s = 0; s < ns; s++)
+      {
+        node1[s] = node(springs[s].connectors[0]);
+        node2[s] = node(springs[s].connectors[1]);
+        length[s] = springs[s].length;
+        stiffness[s] = springs[s].stiffness;
+      }
+
+    bandwidth = 0;
+    for (size_t s = 0; s < ns; s++)
+      if (node1[s] < nmasses && node2[s] < nmasses)
+        bandwidth = std::max(bandwidth, node1[s] > node2[s] ? node1[s]-node2[s] : node2[s]-node1[s]);
+
+    firstspring.assign(nnodes+1, 0);
+    for (size_t s = 0; s < ns; s++)
+      {
+        firstspring[node1[s]+1]++;
+        firstspring[node2[s]+1]++;
+      }
+    for (size_t i = 0; i < nnodes; i++)
+      firstspring[i+1] += firstspring[i];
+    adjsprings.resize(2*ns);
+    std::vector<size_t> cnt(firstspring.begin(), firstspring.end()-1);
+    for (size_t s = 0; s < ns; s++)
+      {
+        adjsprings[cnt[node1[s]]++] = s;
+        adjsprings[cnt[node2[s]]++] = s;
+      }
+
+    colorSprings();
+
+    // reorder the spring arrays by color
+    std::vector<size_t> slot(ns);
+    for (size_t k = 0; k < ns; k++)
+      slot[springindex[k]] = k;
+    auto reorder = [&] (auto & vec)
+    {
+      auto tmp = vec;
+      for (size_t k = 0; k < ns; k++)
+        vec[k] = tmp[springindex[k]];
+    };
+    reorder(node1);
+    reorder(node2);
+    reorder(length);
+    reorder(stiffness);
+    for (auto & sp : adjsprings)
+      sp = slot[sp];
+
+    auto & constraints = mss.constraints();
+    cnode1.resize(constraints.size());
+    cnode2.resize(constraints.size());
+    clength.resize(constraints.size());
+    for (size_t c = 0; c < constraints.size(); c++)
+      {
+        cnode1[c] = node(constraints[c].connectors[0]);
+        cnode2[c] = node(constraints[c].connectors[1]);
+        clength[c] = constraints[c].length;
+      }
+  }
+
+  // true if compiled from a system with these numbers of elements
+  bool sameSize (const MassSpringSystem<D,T> & mss) const
+  {
+    return nmasses == mss.masses().size() && nnodes == nmasses + mss.fixes().size()
+      && nsprings() == mss.springs().size() && nconstraints() == mss.constraints().size();
+  }
+
+  // masses, fix positions, spring lengths and stiffnesses for an unchanged
+  // topology in O(n): the numbering, adjacency and colors are kept
+  void updateParameters (const MassSpringSystem<D,T> & mss)
+  {
+    auto & masses = mss.masses();
+    auto & fixes = mss.fixes();
+    auto & springs = mss.springs();
+    for (size_t i = 0; i < nmasses; i++)
+      invmass[mss.dofNr(i)] = T(1.0) / masses[i].mass;
+    for (int d = 0; d < D; d++)
+      for (size_t i = 0; i < fixes.size(); i++)
+        fixpos[d][i] = fixes[i].pos(d);
+    for (size_t k = 0; k < nsprings(); k++)
+      {
+        length[k] = springs[springindex[k]].length;
+        stiffness[k] = springs[springindex[k]].stiffness;
+      }
+    for (size_t c = 0; c < nconstraints(); c++)
+      clength[c] = mss.constraints()[c].length;
+  }
+
+  size_t ncolors() const { return firstincolor.size()-1; }
+
+  // greedy coloring of the springs: springs of one color touch
+  // disjoint masses (fixes don't count, nothing is accumulated there)
+  void colorSprings ()
+  {
+    size_t ns = nsprings();
+    std::vector<size_t> color(ns), forbidden;
+    size_t ncol = 0;
+    for (size_t s = 0; s < ns; s++)
+      {
+        for (size_t node : { node1[s], node2[s] })
+          if (node < nmasses)
+            for (size_t k = firstspring[node]; k < firstspring[node+1]; k++)
+              if (size_t other = adjsprings[k]; other < s)
+                forbidden[color[other]] = s;
+        size_t c = 0;
+        while (c < ncol && forbidden[c] == s) c++;
+        if (c == ncol)
+          {
+            ncol++;
+            forbidden.push_back(ns);
+          }
+        color[s] = c;
+      }
+
+    firstincolor.assign(ncol+1, 0);
+    for (size_t s = 0; s < ns; s++)
+      firstincolor[color[s]+1]++;
+    for (size_t c = 0; c < ncol; c++)
+      firstincolor[c+1] += firstincolor[c];
+    springindex.resize(ns);
+    std::vector<size_t> cnt(firstincolor.begin(), firstincolor.end()-1);
+    for (size_t s = 0; s < ns; s++)
+      springindex[cnt[color[s]]++] = s;
+  }
+};
+
+
+// one entry of the topology journal of a MassSpringSystem
+struct TopologyChange
+{
+  enum KIND { MASS_ADDED, FIX_ADDED, SPRING_ADDED, SPRING_REMOVED, CONSTRAINT_ADDED, RESET };
+  KIND kind;
+  std::array<Connector,2> connectors;   // of the added or removed spring
+};
+
+
+template <int D, typename T = double>
 class MassSpringSystem
 {
-  std::vector<Fix<D>> m_fixes;
-  std::vector<Mass<D>> m_masses;
-  std::vector<Spring> m_springs;
-  Vec<D> m_gravity=0.0;
+  std::vector<Fix<D,T>> m_fixes;
+  std::vector<Mass<D,T>> m_masses;
+  std::vector<Spring<T>> m_springs;
+  std::vector<DistanceConstraint<T>> m_constraints;
+  Vec<D,T> m_gravity = T(0.0);
+  double m_contactradius = 0.0;
+  double m_contactstiffness = 0.0;
+  std::vector<size_t> m_dofnr;   // mass -> position in the state vector, empty = identity
+
+  // rebuilt on demand after topology changes (m_dirty), only the
+  // parameters are updated after changes of masses, fixes or spring
+  // parameters (m_paramdirty)
+  mutable CompiledMSS<D,T> m_compiled;
+  mutable bool m_dirty = true;
+  mutable bool m_paramdirty = false;
+
+  // topology journal, m_journal[k] leads to version m_journalstart+k+1
+  size_t m_version = 0;
+  size_t m_journalstart = 0;
+  std::vector<TopologyChange> m_journal;
+  static constexpr size_t max_journal = 4096;
+
+  void logChange (TopologyChange::KIND kind, std::array<Connector,2> connectors = { })
+  {
+    if (m_journal.size() == max_journal)
+      {
+        // forget the older half, consumers that far behind rebuild
+        m_journal.erase(m_journal.begin(), m_journal.begin()+max_journal/2);
+        m_journalstart += max_journal/2;
+      }
+    m_journal.push_back({ kind, connectors });
+    m_version++;
+  }
 public:
-  void setGravity (Vec<D> gravity) { m_gravity = gravity; }
-  Vec<D> getGravity() const { return m_gravity; }
+  using scalar_type = T;
+
+  void setGravity (Vec<D,T> gravity) { m_gravity = gravity; }
+  Vec<D,T> getGravity() const { return m_gravity; }
+
+  // Masses closer than 2*radius repel each other like a compressed spring
+  // of rest length 2*radius. Masses joined by a spring don't collide.
+  // radius = 0 turns contact off.
+  void setContact (double radius, double stiffness)
+  {
+    m_contactradius = radius;
+    m_contactstiffness = stiffness;
+  }
+  double getContactRadius() const { return m_contactradius; }
+  double getContactStiffness() const { return m_contactstiffness; }
 
-  Connector addFix (Fix<D> p)
+  Connector addFix (Fix<D,T> p)
   {
+    m_dirty = true;
+    logChange(TopologyChange::FIX_ADDED);
     m_fixes.push_back(p);
     return { Connector::FIX, m_fixes.size()-1 };
   }
 
-  Connector addMass (Mass<D> m)
+  Connector addMass (Mass<D,T> m)
   {
+    m_dirty = true;
+    logChange(TopologyChange::MASS_ADDED);
+    if (!m_dofnr.empty())
+      m_dofnr.push_back(m_masses.size());
     m_masses.push_back (m);
     return { Connector::MASS, m_masses.size()-1 };
   }
 
-  size_t addSpring (Spring s)
+  size_t addSpring (Spring<T> s)
   {
+    m_dirty = true;
+    logChange(TopologyChange::SPRING_ADDED, s.connectors);
     m_springs.push_back (s);
     return m_springs.size()-1;
   }
 
-  auto & fixes() { return m_fixes; }
-  auto & masses() { return m_masses; }
-  auto & springs() { return m_springs; }
+  // removes spring s in O(1), the last spring takes over its number
+  void removeSpring (size_t s)
+  {
+    m_dirty = true;
+    logChange(TopologyChange::SPRING_REMOVED, m_springs[s].connectors);
+    m_springs[s] = m_springs.back();
+    m_springs.pop_back();
+  }
+
+  size_t addConstraint (DistanceConstraint<T> c)
+  {
+    m_dirty = true;
+    logChange(TopologyChange::CONSTRAINT_ADDED, c.connectors);
+    m_constraints.push_back (c);
+    return m_constraints.size()-1;
+  }
+
+  // Non-const access to fixes and masses only changes parameters. Springs
+  // and constraints could be rewired, non-const access is a topology
+  // change (RESET), use setSpringStiffness / setSpringLength for their
+  // parameters and the const versions for reading.
+  auto & fixes() { m_paramdirty = true; return m_fixes; }
+  auto & masses() { m_paramdirty = true; return m_masses; }
+  auto & springs() { m_dirty = true; logChange(TopologyChange::RESET); return m_springs; }
+  auto & constraints() { m_dirty = true; logChange(TopologyChange::RESET); return m_constraints; }
+  auto & fixes() const { return m_fixes; }
+  auto & masses() const { return m_masses; }
+  auto & springs() const { return m_springs; }
+  auto & constraints() const { return m_constraints; }
+
+  void setSpringStiffness (size_t s, T stiffness)
+  {
+    m_springs[s].stiffness = stiffness;
+    m_paramdirty = true;
+  }
+
+  void setSpringLength (size_t s, T length)
+  {
+    m_springs[s].length = length;
+    m_paramdirty = true;
+  }
+
+  // Incremented by every change of the topology: added elements, removed
+  // springs, new dof numbers and non-const access to the springs or
+  // constraints (which could rewire them). Masses pushed directly into
+  // masses() are only visible by their count.
+  size_t topologyVersion() const { return m_version; }
+
+  // f(change) for all changes after version, in order. Returns false if
+  // the journal does not reach back that far, caches then have to rebuild.
+  template <typename F>
+  bool forChangesSince (size_t version, F f) const
+  {
+    if (version < m_journalstart || version > m_version) return false;
+    for (size_t k = version-m_journalstart; k < m_journal.size(); k++)
+      f(m_journal[k]);
+    return true;
+  }
+
+  // position of mass i in the state vectors of getState / setState
+  size_t dofNr (size_t i) const { return m_dofnr.empty() ? i : m_dofnr[i]; }
+  const std::vector<size_t> & dofNumbers() const { return m_dofnr; }
+  void setDofNumbers (std::vector<size_t> dofnr)
+  {
+    m_dofnr = std::move(dofnr);
+    m_dirty = true;
+    logChange(TopologyChange::RESET);
+  }
+
+  // Reverse Cuthill-McKee numbering of the state: masses joined by a spring
+  // get close dof numbers, so the Jacobian becomes narrow banded.
+  // Masses and Connectors keep their numbers, only getState / setState
+  // (and thus the solution vector) use the new order, see dofNr.
+  // The insertion order is kept if its bandwidth is already smaller.
+  void renumberMasses ()
+  {
+    size_t n = m_masses.size();
+    std::vector<size_t> first(n+1, 0), adj;
+    auto isMass = [] (const Spring<T> & sp)
+    { return sp.connectors[0].type == Connector::MASS && sp.connectors[1].type == Connector::MASS; };
+    for (auto & sp : m_springs)
+      if (isMass(sp))
+        {
+          first[sp.connectors[0].nr+1]++;
+          first[sp.connectors[1].nr+1]++;
+        }
+    for (size_t i = 0; i < n; i++)
+      first[i+1] += first[i];
+    adj.resize(first[n]);
+    std::vector<size_t> cnt(first.begin(), first.end()-1);
+    for (auto & sp : m_springs)
+      if (isMass(sp))
+        {
+          adj[cnt[sp.connectors[0].nr]++] = sp.connectors[1].nr;
+          adj[cnt[sp.connectors[1].nr]++] = sp.connectors[0].nr;
+        }
+    auto degree = [&] (size_t i) { return first[i+1]-first[i]; };
+
+    // breadth first search, neighbors by increasing degree
+    std::vector<char> seen(n, 0);
+    auto bfs = [&] (size_t start, std::vector<size_t> & seq)
+    {
+      seq.assign(1, start);
+      seen[start] = 1;
+      for (size_t k = 0; k < seq.size(); k++)
+        {
+          size_t newfirst = seq.size();
+          for (size_t l = first[seq[k]]; l < first[seq[k]+1]; l++)
+            if (!seen[adj[l]])
+              {
+                seen[adj[l]] = 1;
+                seq.push_back(adj[l]);
+              }
+          std::sort(seq.begin()+newfirst, seq.end(),
+                    [&] (size_t a, size_t b) { return degree(a) < degree(b); });
+        }
+    };
+
+    std::vector<size_t> order, component;
+    order.reserve(n);
+    for (size_t i = 0; i < n; i++)
+      if (!seen[i])
+        {
+          // start from the far end of the component (pseudo-peripheral node)
+          bfs(i, component);
+          for (size_t j : component) seen[j] = 0;
+          bfs(component.back(), component);
+          order.insert(order.end(), component.begin(), component.end());
+        }
+
+    std::vector<size_t> dofnr(n);
+    for (size_t k = 0; k < n; k++)
+      dofnr[order[n-1-k]] = k;
+
+    auto bandwidth = [&] (auto nr)
+    {
+      size_t bw = 0;
+      for (size_t i = 0; i < n; i++)
+        for (size_t l = first[i]; l < first[i+1]; l++)
+          if (nr(i) > nr(adj[l]))
+            bw = std::max(bw, nr(i)-nr(adj[l]));
+      return bw;
+    };
+    if (bandwidth([&] (size_t i) { return dofnr[i]; }) < bandwidth([] (size_t i) { return i; }))
+      m_dofnr = std::move(dofnr);
+    else
+      m_dofnr.clear();
+    m_dirty = true;
+    logChange(TopologyChange::RESET);
+  }
+
+  const CompiledMSS<D,T> & compiled() const
+  {
+    // masses or fixes pushed directly into the vectors need a full compile
+    if (m_paramdirty && !m_compiled.sameSize(*this))
+      m_dirty = true;
+    if (m_dirty)
+      m_compiled.compile(*this);
+    else if (m_paramdirty)
+      m_compiled.updateParameters(*this);
+    m_dirty = m_paramdirty = false;
+    return m_compiled;
+  }
 
-  void getState (VectorView<> values, VectorView<> dvalues, VectorView<> ddvalues)
+  void getState (VectorView<T> values, VectorView<T> dvalues, VectorView<T> ddvalues)
   {
     auto valmat = values.asMatrix(m_masses.size(), D);
     auto dvalmat = dvalues.asMatrix(m_masses.size(), D);
@@ -92,13 +517,13 @@ public:
 
     for (size_t i = 0; i < m_masses.size(); i++)
       {
-        valmat.row(i) = m_masses[i].pos;
-        dvalmat.row(i) = m_masses[i].vel;
-        ddvalmat.row(i) = m_masses[i].acc;
+        valmat.row(dofNr(i)) = m_masses[i].pos;
+        dvalmat.row(dofNr(i)) = m_masses[i].vel;
+        ddvalmat.row(dofNr(i)) = m_masses[i].acc;
       }
   }
 
-  void setState (VectorView<> values, VectorView<> dvalues, VectorView<> ddvalues)
+  void setState (VectorView<T> values, VectorView<T> dvalues, VectorView<T> ddvalues)
   {
     auto valmat = values.asMatrix(m_masses.size(), D);
     auto dvalmat = dvalues.asMatrix(m_masses.size(), D);
@@ -106,15 +531,48 @@ public:
 
     for (size_t i = 0; i < m_masses.size(); i++)
       {
-        m_masses[i].pos = valmat.row(i);
-        m_masses[i].vel = dvalmat.row(i);
-        m_masses[i].acc = ddvalmat.row(i);
+        m_masses[i].pos = valmat.row(dofNr(i));
+        m_masses[i].vel = dvalmat.row(dofNr(i));
+        m_masses[i].acc = ddvalmat.row(dofNr(i));
       }
   }
 };
 
-template <int D>
-std::ostream & operator<< (std::ostream & ost, MassSpringSystem<D> & mss)
+// copy of mss in another scalar type, e.g. float for ensemble runs or
+// AutoDiff, after which some parameters can be made Variables
+template <typename T2, int D, typename T>
+MassSpringSystem<D,T2> ConvertScalar (const MassSpringSystem<D,T> & mss)
+{
+  auto conv = [] (const T & v)
+  {
+    if constexpr (std::is_convertible_v<T,T2>) return T2(v);
+    else return T2(ScalarValue(v));
+  };
+  auto convVec = [&] (const Vec<D,T> & v)
+  {
+    Vec<D,T2> res;
+    for (int d = 0; d < D; d++)
+      res(d) = conv(v(d));
+    return res;
+  };
+
+  MassSpringSystem<D,T2> res;
+  res.setGravity(convVec(mss.getGravity()));
+  res.setContact(mss.getContactRadius(), mss.getContactStiffness());
+  for (auto & f : mss.fixes())
+    res.addFix({ convVec(f.pos) });
+  for (auto & m : mss.masses())
+    res.addMass({ conv(m.mass), convVec(m.pos), convVec(m.vel), convVec(m.acc) });
+  for (auto & sp : mss.springs())
+    res.addSpring({ conv(sp.length), conv(sp.stiffness), sp.connectors });
+  for (auto & c : mss.constraints())
+    res.addConstraint({ conv(c.length), c.connectors });
+  res.setDofNumbers(mss.dofNumbers());
+  return res;
+}
+
+template <int D, typename T>
+std::ostream & operator<< (std::ostream & ost, const MassSpringSystem<D,T> & mss)
 {
   ost << "fixes:" << std::endl;
   for (auto f : mss.fixes())
@@ -128,73 +586,473 @@ std::ostream & operator<< (std::ostream & ost, MassSpringSystem<D> & mss)
   for (auto sp : mss.springs())
     ost << "length = " << sp.length << ", stiffness = " << sp.stiffness
         << ", C1 = " << sp.connectors[0] << ", C2 = " << sp.connectors[1] << std::endl;
+
+  if (!mss.constraints().empty())
+    ost << "constraints: " << std::endl;
+  for (auto c : mss.constraints())
+    ost << "length = " << c.length
+        << ", C1 = " << c.connectors[0] << ", C2 = " << c.connectors[1] << std::endl;
   return ost;
 }
 
 
+// Critical time step 2/omega_max of explicit (central difference) methods.
+// omega_max^2 is the largest eigenvalue of M^{-1/2} K M^{-1/2}. A spring
+// couples its end points by the block k uu^T + k(1-l0/r)(I-uu^T) of norm
+// c = max(k, k|1-l0/r|), so block Gershgorin bounds omega_max^2 by
+//   max_i  sum_{springs at i}  c (1/m_i + 1/sqrt(m_i m_j)),
+// per-spring sqrt(m/k)-type bounds computed in one sweep over the springs.
+// Contacts (setContact) are penalty springs of stiffness k_c and length 2R.
+// While they overlap by at most half (r >= R), c = k_c, and masses at
+// least R apart leave at most 5^D-1 of them within 2R of a mass (disjoint
+// balls of radius R/2 in one of radius 2.5R), each adding
+// k_c (1/m_i + 1/sqrt(m_i m_min)).
 template <int D>
+double CriticalTimeStep (const MassSpringSystem<D> & mss)
+{
+  auto & masses = mss.masses();
+  std::vector<double> bound(masses.size(), 0.0);
+
+  for (auto & spring : mss.springs())
+    {
+      auto [c1,c2] = spring.connectors;
+      Vec<D> p1 = (c1.type == Connector::FIX) ? mss.fixes()[c1.nr].pos : masses[c1.nr].pos;
+      Vec<D> p2 = (c2.type == Connector::FIX) ? mss.fixes()[c2.nr].pos : masses[c2.nr].pos;
+      double r = norm(p2-p1);
+      double c = spring.stiffness;
+      if (r > 0)
+        c = std::max(c, spring.stiffness * std::abs(1-spring.length/r));
+
+      if (c1.type == Connector::MASS)
+        {
+          double m1 = masses[c1.nr].mass;
+          bound[c1.nr] += c / m1;
+          if (c2.type == Connector::MASS)
+            bound[c1.nr] += c / std::sqrt(m1*masses[c2.nr].mass);
+        }
+      if (c2.type == Connector::MASS)
+        {
+          double m2 = masses[c2.nr].mass;
+          bound[c2.nr] += c / m2;
+          if (c1.type == Connector::MASS)
+            bound[c2.nr] += c / std::sqrt(m2*masses[c1.nr].mass);
+        }
+    }
+
+  double kc = mss.getContactStiffness();
+  if (mss.getContactRadius() > 0 && kc > 0 && !masses.empty())
+    {
+      double mmin = masses[0].mass;
+      for (auto & m : masses)
+        mmin = std::min(mmin, m.mass);
+      double ncontacts = std::pow(5.0, D) - 1;
+      for (size_t i = 0; i < masses.size(); i++)
+        bound[i] += ncontacts * kc * (1/masses[i].mass + 1/std::sqrt(masses[i].mass*mmin));
+    }
+
+  double omega2 = 0;
+  for (double b : bound)
+    omega2 = std::max(omega2, b);
+  if (omega2 == 0)
+    return std::numeric_limits<double>::infinity();
+  return 2.0/std::sqrt(omega2);
+}
+
+// number of stable central difference steps for [0,tend]
+template <int D>
+int StableTimeSteps (const MassSpringSystem<D> & mss, double tend, double safety = 0.9)
+{
+  return std::max(1, int(std::ceil(tend / (safety*CriticalTimeStep(mss)))));
+}
+
+
+// Accelerations of the masses. evaluate and evaluateDeriv stream through
+// the compiled (SoA) representation of the system.
+// The kernels run in the scalar type T of the system: float packs twice
+// as many springs into a SIMD register, AutoDiff runs springwise and
+// gives exact parameter derivatives via accelerations(x, f).
+// The NonlinearFunction interface (for the solvers) stays double.
+// Distance constraints are not included, see mss_constraints.hpp.
+template <int D, typename T = double>
 class MSS_Function : public NonlinearFunction
 {
-  MassSpringSystem<D> & mss;
-public:
-  MSS_Function (MassSpringSystem<D> & _mss)
-    : mss(_mss) { }
+  const MassSpringSystem<D,T> & mss;
+  mutable std::array<std::vector<T>,D> m_pos, m_force;
+  mutable std::array<std::vector<double>,D> m_hashpos;
+  mutable SpatialHash<D> m_hash;
 
-  virtual size_t dimX() const override { return D*mss.masses().size(); }
-  virtual size_t dimF() const override{ return D*mss.masses().size(); }
+  // springs per SIMD register
+  static constexpr size_t simd_width =
+    std::is_same_v<T,double> ? SIMD_DOUBLE_WIDTH : std::is_same_v<T,float> ? SIMD_FLOAT_WIDTH : 1;
 
-  virtual void evaluate (VectorView<double> x, VectorView<double> f) const override
+  // node coordinates by component, masses from x, then the fixes
+  template <typename TX>
+  void gatherPositions (const CompiledMSS<D,T> & cmss, VectorView<TX> x) const
   {
-    f = 0.0;
+    size_t nm = cmss.nmasses;
+    for (int d = 0; d < D; d++)
+      {
+        auto & pos = m_pos[d];
+        pos.resize(cmss.nnodes);
+        for (size_t i = 0; i < nm; i++)
+          pos[i] = T(x(i*D+d));
+        std::copy(cmss.fixpos[d].begin(), cmss.fixpos[d].end(), pos.begin()+nm);
+      }
+  }
+
+  // forces of the W springs starting at s, vectorized over the springs
+  template <size_t W>
+  void springForces (const CompiledMSS<D,T> & cmss, size_t s) const
+  {
+    using SIMDW = SIMD<T,W>;
+    SIMDW diff[D];
+    SIMDW r2(0.0);
+    for (int d = 0; d < D; d++)
+      {
+        diff[d] = SIMDW::gather(m_pos[d].data(), &cmss.node2[s])
+          - SIMDW::gather(m_pos[d].data(), &cmss.node1[s]);
+        r2 = r2 + diff[d]*diff[d];
+      }
+    SIMDW r = sqrt(r2);
+    SIMDW fac = SIMDW::load(&cmss.stiffness[s]) * (r - SIMDW::load(&cmss.length[s])) / r;
+
+    // scatter lane by lane, nothing is accumulated on fixes
+    size_t nm = cmss.nmasses;
+    for (size_t l = 0; l < W; l++)
+      {
+        size_t i = cmss.node1[s+l], j = cmss.node2[s+l];
+        for (int d = 0; d < D; d++)
+          {
+            T fd = fac[l]*diff[d][l];
+            if (i < nm) m_force[d][i] += fd;
+            if (j < nm) m_force[d][j] -= fd;
+          }
+      }
+  }
+
+  // Jacobian blocks  K = k(1-l0/r) I + k l0/r u u^T  of the W springs starting at s.
+  // A spring only writes to the rows of its own masses.
+  template <size_t W, typename MAT>
+  void springJacobians (const CompiledMSS<D,T> & cmss, size_t s, MAT & df) const
+  {
+    using SIMDW = SIMD<T,W>;
+    SIMDW u[D];
+    SIMDW r2(0.0);
+    for (int d = 0; d < D; d++)
+      {
+        u[d] = SIMDW::gather(m_pos[d].data(), &cmss.node2[s])
+          - SIMDW::gather(m_pos[d].data(), &cmss.node1[s]);
+        r2 = r2 + u[d]*u[d];
+      }
+    SIMDW r = sqrt(r2);
+    SIMDW rinv = SIMDW(1.0) / r;
+    for (int d = 0; d < D; d++)
+      u[d] = u[d]*rinv;
 
-    auto xmat = x.asMatrix(mss.masses().size(), D);
-    auto fmat = f.asMatrix(mss.masses().size(), D);
+    SIMDW k = SIMDW::load(&cmss.stiffness[s]);
+    SIMDW l0rinv = SIMDW::load(&cmss.length[s]) * rinv;
+    SIMDW alpha = k * (SIMDW(1.0) - l0rinv);
+    SIMDW beta = k * l0rinv;
 
-    for (size_t i = 0; i < mss.masses().size(); i++)
-      fmat.row(i) = mss.masses()[i].mass*mss.getGravity();
+    SIMDW K[D][D];
+    for (int a = 0; a < D; a++)
+      for (int b = 0; b < D; b++)
+        K[a][b] = (a == b) ? alpha + beta*u[a]*u[b] : beta*u[a]*u[b];
 
-    for (auto spring : mss.springs())
+    size_t nm = cmss.nmasses;
+    for (size_t l = 0; l < W; l++)
       {
-        auto [c1,c2] = spring.connectors;
-        Vec<D> p1, p2;
-        if (c1.type == Connector::FIX)
-          p1 = mss.fixes()[c1.nr].pos;
-        else
-          p1 = xmat.row(c1.nr);
-        if (c2.type == Connector::FIX)
-          p2 = mss.fixes()[c2.nr].pos;
-        else
-          p2 = xmat.row(c2.nr);
+        if (ScalarValue(r[l]) < 1e-12) continue;
+        size_t i = cmss.node1[s+l], j = cmss.node2[s+l];
+        if (i < nm)
+          {
+            double invm = ScalarValue(cmss.invmass[i]);
+            for (int a = 0; a < D; a++)
+              for (int b = 0; b < D; b++)
+                {
+                  double Kab = ScalarValue(K[a][b][l]);
+                  df(i*D+a, i*D+b) -= invm * Kab;
+                  if (j < nm) df(i*D+a, j*D+b) += invm * Kab;
+                }
+          }
+        if (j < nm)
+          {
+            double invm = ScalarValue(cmss.invmass[j]);
+            for (int a = 0; a < D; a++)
+              for (int b = 0; b < D; b++)
+                {
+                  double Kab = ScalarValue(K[a][b][l]);
+                  df(j*D+a, j*D+b) -= invm * Kab;
+                  if (i < nm) df(j*D+a, i*D+b) += invm * Kab;
+                }
+          }
+      }
+  }
+
+  // f(i, j, k, l0) for all pairs of masses in contact, they act as a
+  // compressed spring of stiffness k and rest length l0
+  template <typename F>
+  void forAllContacts (const CompiledMSS<D,T> & cmss, F f) const
+  {
+    double dist = 2*mss.getContactRadius();
+    if (dist <= 0) return;
+    double k = mss.getContactStiffness();
 
-        double force = spring.stiffness * (norm(p1-p2)-spring.length);
-        Vec<D> dir12 = 1.0/norm(p1-p2) * (p2-p1);
-        if (c1.type == Connector::MASS)
-          fmat.row(c1.nr) += force*dir12;
-        if (c2.type == Connector::MASS)
-          fmat.row(c2.nr) -= force*dir12;
+    // the hash works on plain double coordinates
+    const std::array<std::vector<double>,D> * pos;
+    if constexpr (std::is_same_v<T,double>)
+      pos = &m_pos;
+    else
+      {
+        for (int d = 0; d < D; d++)
+          {
+            m_hashpos[d].resize(cmss.nmasses);
+            for (size_t i = 0; i < cmss.nmasses; i++)
+              m_hashpos[d][i] = ScalarValue(m_pos[d][i]);
+          }
+        pos = &m_hashpos;
       }
 
-    for (size_t i = 0; i < mss.masses().size(); i++)
-      fmat.row(i) *= 1.0/mss.masses()[i].mass;
+    m_hash.build(*pos, cmss.nmasses, dist);
+    m_hash.forAllPairs(*pos, [&] (size_t i, size_t j)
+    {
+      for (size_t l = cmss.firstspring[i]; l < cmss.firstspring[i+1]; l++)
+        {
+          size_t s = cmss.adjsprings[l];
+          if (cmss.node1[s] == j || cmss.node2[s] == j) return;
+        }
+      f(i, j, k, dist);
+    });
   }
 
-  virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  // kernel(first, next) on ranges of springs. Springs in a color share
+  // no mass, so the ranges of one color run in parallel without atomics.
+  // Small systems stay serial.
+  template <typename F>
+  void forSpringRanges (const CompiledMSS<D,T> & cmss, F kernel) const
   {
-    // TODO: exact differentiation
-    double eps = 1e-8;
-    Vector<> xl(dimX()), xr(dimX()), fl(dimF()), fr(dimF());
-    for (size_t i = 0; i < dimX(); i++)
+    size_t ns = cmss.nsprings();
+    if (ns < parallel_threshold || TaskManager::instance().numThreads() == 1)
       {
-        xl = x;
-        xl(i) -= eps;
-        xr = x;
-        xr(i) += eps;
-        evaluate (xl, fl);
-        evaluate (xr, fr);
-        df.col(i) = 1/(2*eps) * (fr-fl);
+        kernel(0, ns);
+        return;
+      }
+    for (size_t c = 0; c < cmss.ncolors(); c++)
+      {
+        size_t first = cmss.firstincolor[c];
+        ParallelForRange (cmss.firstincolor[c+1]-first, [&] (size_t a, size_t b)
+        {
+          kernel(first+a, first+b);
+        });
       }
   }
 
+  // f = accelerations at x, x and f in double or in T
+  template <typename TX>
+  void computeAccelerations (VectorView<TX> x, VectorView<TX> f) const
+  {
+    auto & cmss = mss.compiled();
+    gatherPositions(cmss, x);
+    for (int d = 0; d < D; d++)
+      m_force[d].assign(cmss.nnodes, T(0.0));
+
+    forSpringRanges (cmss, [&] (size_t first, size_t next)
+    {
+      constexpr size_t W = simd_width;
+      size_t s = first;
+      for ( ; s+W <= next; s += W)
+        springForces<W> (cmss, s);
+      for ( ; s < next; s++)
+        springForces<1> (cmss, s);
+    });
+
+    forAllContacts (cmss, [&] (size_t i, size_t j, double k, double l0)
+    {
+      T diff[D];
+      T r2(0.0);
+      for (int d = 0; d < D; d++)
+        {
+          diff[d] = m_pos[d][j]-m_pos[d][i];
+          r2 += diff[d]*diff[d];
+        }
+      using std::sqrt;
+      T r = sqrt(r2);
+      if (ScalarValue(r) < 1e-12) return;
+      T fac = T(k) * (r-T(l0)) / r;
+      for (int d = 0; d < D; d++)
+        {
+          m_force[d][i] += fac*diff[d];
+          m_force[d][j] -= fac*diff[d];
+        }
+    });
+
+    Vec<D,T> gravity = mss.getGravity();
+    for (size_t i = 0; i < cmss.nmasses; i++)
+      for (int d = 0; d < D; d++)
+        {
+          T acc = gravity(d) + cmss.invmass[i] * m_force[d][i];
+          if constexpr (std::is_same_v<TX,T>)
+            f(i*D+d) = acc;
+          else
+            f(i*D+d) = ScalarValue(acc);
+        }
+  }
+
+  // adds the exact Jacobian to df (dense or band matrix)
+  template <typename MAT>
+  void addJacobian (VectorView<double> x, MAT & df) const
+  {
+    auto & cmss = mss.compiled();
+    gatherPositions(cmss, x);
+
+    forSpringRanges (cmss, [&] (size_t first, size_t next)
+    {
+      constexpr size_t W = simd_width;
+      size_t s = first;
+      for ( ; s+W <= next; s += W)
+        springJacobians<W> (cmss, s, df);
+      for ( ; s < next; s++)
+        springJacobians<1> (cmss, s, df);
+    });
+
+    forAllContacts (cmss, [&] (size_t i, size_t j, double k, double l0)
+    {
+      double u[D];
+      double r2 = 0;
+      for (int d = 0; d < D; d++)
+        {
+          u[d] = ScalarValue(m_pos[d][j]-m_pos[d][i]);
+          r2 += u[d]*u[d];
+        }
+      double r = std::sqrt(r2);
+      if (r < 1e-12) return;
+      for (int d = 0; d < D; d++)
+        u[d] /= r;
+
+      double alpha = k * (1.0 - l0 / r);
+      double beta  = k * (l0 / r);
+      double invmi = ScalarValue(cmss.invmass[i]), invmj = ScalarValue(cmss.invmass[j]);
+      for (int a = 0; a < D; a++)
+        for (int b = 0; b < D; b++)
+          {
+            double K = (a == b ? alpha : 0.0) + beta * u[a] * u[b];
+            df(i*D+a, i*D+b) -= invmi * K;
+            df(i*D+a, j*D+b) += invmi * K;
+            df(j*D+a, j*D+b) -= invmj * K;
+            df(j*D+a, i*D+b) += invmj * K;
+          }
+    });
+  }
+
+public:
+  static constexpr size_t parallel_threshold = 10000;
+
+  MSS_Function (const MassSpringSystem<D,T> & _mss)
+    : mss(_mss) { }
+
+  virtual size_t dimX() const override { return D*mss.masses().size(); }
+  virtual size_t dimF() const override{ return D*mss.masses().size(); }
+
+  // springs couple the dofs of masses at most cmss.bandwidth numbers apart,
+  // contacts can couple any two masses
+  virtual size_t bandwidth() const override
+  {
+    if (mss.getContactRadius() > 0) return dimX();
+    return D*(mss.compiled().bandwidth+1)-1;
+  }
+
+  virtual void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    computeAccelerations(x, f);
+  }
+
+  // accelerations in the scalar type of the system, e.g. with
+  // AutoDiff stiffnesses f carries the derivatives by the stiffnesses
+  void accelerations (VectorView<T> x, VectorView<T> f) const
+  {
+    computeAccelerations(x, f);
+  }
+
+  // energy 1/2 k (r-l0)^2 of the contact penalty springs at x
+  double contactEnergy (VectorView<double> x) const
+  {
+    auto & cmss = mss.compiled();
+    gatherPositions(cmss, x);
+    double energy = 0;
+    forAllContacts (cmss, [&] (size_t i, size_t j, double k, double l0)
+    {
+      double r2 = 0;
+      for (int d = 0; d < D; d++)
+        {
+          double diff = ScalarValue(m_pos[d][j]-m_pos[d][i]);
+          r2 += diff*diff;
+        }
+      double stretch = std::sqrt(r2) - l0;
+      energy += 0.5 * k * stretch*stretch;
+    });
+    return energy;
+  }
+
+  // exact Jacobian (by x, in double)
+  virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    addJacobian(x, df);
+  }
+
+  virtual bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+  {
+    if (bandwidth() > df.bandwidth()) return false;
+    df.setZero();
+    addJacobian(x, df);
+    return true;
+  }
+
+  // Jacobian in a skyline matrix, its profile has to cover the springs
+  // (see MSS_Pattern, MSS_SkylineFunction). Contacts are not in the
+  // pattern, returns false then.
+  virtual bool evaluateSkylineDeriv (VectorView<double> x, SkylineMatrix & df) const override
+  {
+    if (mss.getContactRadius() > 0 || df.size() != dimX()) return false;
+    df.setZero();
+    addJacobian(x, df);
+    return true;
+  }
 };
 
+
+// d acc/d k for the stiffnesses k of the given springs, the
+// ParameterDerivative for sensitivities of x(t) by them (e.g. for
+// SolveODE_Alpha). Column j belongs to springs[j].
+template <int D>
+ParameterDerivative MSS_StiffnessDerivative (const MassSpringSystem<D> & mss,
+                                             std::vector<size_t> springs)
+{
+  return [&mss, springs] (VectorView<double> x, MatrixView<double> dfdp)
+  {
+    dfdp = 0.0;
+    auto pos = [&] (Connector c, int d)
+    {
+      return c.type == Connector::MASS ? x(mss.dofNr(c.nr)*D+d) : mss.fixes()[c.nr].pos(d);
+    };
+    for (size_t j = 0; j < springs.size(); j++)
+      {
+        auto [c1,c2] = mss.springs()[springs[j]].connectors;
+        Vec<D> diff;
+        for (int d = 0; d < D; d++)
+          diff(d) = pos(c2,d) - pos(c1,d);
+        double r = norm(diff);
+        if (r < 1e-12) continue;
+        double fac = (r - mss.springs()[springs[j]].length) / r;
+        for (int d = 0; d < D; d++)
+          {
+            if (c1.type == Connector::MASS)
+              dfdp(mss.dofNr(c1.nr)*D+d, j) += fac*diff(d) / mss.masses()[c1.nr].mass;
+            if (c2.type == Connector::MASS)
+              dfdp(mss.dofNr(c2.nr)*D+d, j) -= fac*diff(d) / mss.masses()[c2.nr].mass;
+          }
+      }
+  };
+}
+
 #endif
@@ -0,0 +1,353 @@
+#ifndef MODAL_ROM_HPP
+#define MODAL_ROM_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <inverse.hpp>
+#include "mass_spring.hpp"
+
+
+// Eigenvalues (ascending) and orthonormal eigenvectors (columns of v)
+// of the small symmetric matrix a by cyclic Jacobi rotations. a is overwritten.
+inline void SymmetricEigen (MatrixView<double> a, VectorView<double> lam, MatrixView<double> v,
+                            double tol = 1e-14, int maxsweeps = 50)
+{
+  size_t n = a.rows();
+  v = 0.0;
+  v.diag() = 1.0;
+
+  for (int sweep = 0; sweep < maxsweeps; sweep++)
+    {
+      double off = 0, diag = 0;
+      for (size_t i = 0; i < n; i++)
+        {
+          diag += a(i,i)*a(i,i);
+          for (size_t j = i+1; j < n; j++)
+            off += a(i,j)*a(i,j);
+        }
+      if (off <= tol*tol*diag) break;
+
+      for (size_t p = 0; p < n; p++)
+        for (size_t q = p+1; q < n; q++)
+          {
+            if (a(p,q) == 0) continue;
+            double theta = (a(q,q)-a(p,p)) / (2*a(p,q));
+            double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta*theta+1));
+            double c = 1/std::sqrt(t*t+1), s = t*c;
+            for (size_t k = 0; k < n; k++)
+              {
+                double akp = a(k,p), akq = a(k,q);
+                a(k,p) = c*akp - s*akq;
+                a(k,q) = s*akp + c*akq;
+              }
+            for (size_t k = 0; k < n; k++)
+              {
+                double apk = a(p,k), aqk = a(q,k);
+                a(p,k) = c*apk - s*aqk;
+                a(q,k) = s*apk + c*aqk;
+              }
+            for (size_t k = 0; k < n; k++)
+              {
+                double vkp = v(k,p), vkq = v(k,q);
+                v(k,p) = c*vkp - s*vkq;
+                v(k,q) = s*vkp + c*vkq;
+              }
+          }
+    }
+
+  // sort ascending
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&] (size_t i, size_t j) { return a(i,i) < a(j,j); });
+  Matrix<> vs(n, n);
+  for (size_t j = 0; j < n; j++)
+    {
+      lam(j) = a(order[j], order[j]);
+      vs.col(j) = v.col(order[j]);
+    }
+  v = vs;
+}
+
+
+
+// Reduced dynamics in modal coordinates  q'' = r - diag(omega^2) q
+class ModalFunction : public NonlinearFunction
+{
+  Vector<> m_omega2, m_force;
+public:
+  ModalFunction (VectorView<double> omega2, VectorView<double> force)
+    : m_omega2(omega2), m_force(force) { }
+
+  size_t dimX() const override { return m_omega2.size(); }
+  size_t dimF() const override { return m_omega2.size(); }
+  void evaluate (VectorView<double> q, VectorView<double> f) const override
+  {
+    for (size_t i = 0; i < f.size(); i++)
+      f(i) = m_force(i) - m_omega2(i)*q(i);
+  }
+  void evaluateDeriv (VectorView<double> q, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    for (size_t i = 0; i < dimX(); i++)
+      df(i,i) = -m_omega2(i);
+  }
+  bool evaluateDiagDeriv (VectorView<double> q, VectorView<double> d) const override
+  {
+    for (size_t i = 0; i < dimX(); i++)
+      d(i) = -m_omega2(i);
+    return true;
+  }
+  size_t bandwidth() const override { return 0; }
+  bool evaluateBandDeriv (VectorView<double> q, BandMatrix & df) const override
+  {
+    return DiagToBand(*this, q, df);
+  }
+};
+
+
+
+// Modal reduced order model of a mass-spring system linearized at x0:
+//
+//   x = x0 + Phi q,   q'' = Phi^T M f(x0) - diag(omega^2) q
+//
+// Phi are the k lowest eigenmodes of  K phi = omega^2 M phi, K = -M df/dx,
+// normalized to Phi^T M Phi = I. They are found by subspace iteration with
+// the symmetric matrix  M^{-1/2} K M^{-1/2},  its (shifted) factorization is
+// banded LU if the system is narrow banded (see renumberMasses), else a
+// dense inverse. Rayleigh-Ritz on the subspace uses SymmetricEigen.
+template <int D>
+class ModalROM
+{
+  Vector<> m_x0;
+  Vector<> m_mass;      // per dof
+  Matrix<> m_modes;     // n x k, M-orthonormal
+  Vector<> m_omega2;
+  Vector<> m_force;     // Phi^T M f(x0)
+  int m_iterations = 0;
+
+public:
+  ModalROM (const MassSpringSystem<D> & mss, VectorView<double> x0, size_t k,
+            double tol = 1e-10, int maxsteps = 200)
+    : m_x0(x0), m_mass(x0.size()), m_modes(x0.size(), k), m_omega2(k), m_force(k)
+  {
+    MSS_Function<D> func(mss);
+    size_t n = func.dimX();
+    if (k == 0 || k > n)
+      throw std::invalid_argument("ModalROM: need 0 < k <= number of dofs");
+
+    Vector<> sqm(n);
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      for (int d = 0; d < D; d++)
+        m_mass(mss.dofNr(i)*D+d) = mss.masses()[i].mass;
+    for (size_t i = 0; i < n; i++)
+      sqm(i) = std::sqrt(m_mass(i));
+
+    // A = M^{-1/2} K M^{-1/2} = -M^{1/2} J M^{-1/2}, and a factorization of A + shift I
+    size_t bw = func.bandwidth();
+    bool banded = UseBandedJacobian(func);
+    BandMatrix bandA(banded ? n : 0, bw), bandLU(banded ? n : 0, bw);
+    // band not available after all: dense
+    if (banded && !func.evaluateBandDeriv(x0, bandA))
+      banded = false;
+    Matrix<> denseA(banded ? 0 : n, banded ? 0 : n), denseInv(banded ? 0 : n, banded ? 0 : n);
+
+    double maxdiag = 0;
+    if (banded)
+      {
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = (i > bw ? i-bw : 0); j <= std::min(n-1, i+bw); j++)
+            bandA(i,j) *= -sqm(i) / sqm(j);
+        for (size_t i = 0; i < n; i++)
+          maxdiag = std::max(maxdiag, std::abs(bandA(i,i)));
+      }
+    else
+      {
+        func.evaluateDeriv(x0, denseA);
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = 0; j < n; j++)
+            denseA(i,j) *= -sqm(i) / sqm(j);
+        for (size_t i = 0; i < n; i++)
+          maxdiag = std::max(maxdiag, std::abs(denseA(i,i)));
+      }
+
+    // small shift, A is singular for unsupported (rigid body) modes
+    double shift = 1e-8 * std::max(maxdiag, 1.0);
+    if (banded)
+      {
+        bandLU = bandA;
+        for (size_t i = 0; i < n; i++)
+          bandLU(i,i) += shift;
+        bandLU.factor();
+      }
+    else
+      {
+        denseInv = denseA;
+        for (size_t i = 0; i < n; i++)
+          denseInv(i,i) += shift;
+        calcInverse(denseInv);
+      }
+
+    auto applyA = [&] (VectorView<double> v, VectorView<double> av)
+    {
+      if (banded)
+        bandA.mult(v, av);
+      else
+        av = denseA * v;
+    };
+    auto solveShifted = [&] (VectorView<double> v)
+    {
+      if (banded)
+        bandLU.solve(v);
+      else
+        {
+          Vector<> tmp = denseInv * v;
+          v = tmp;
+        }
+    };
+
+    // subspace iteration on p > k vectors for faster convergence of the first k
+    size_t p = std::min(n, 2*k + 4);
+    Matrix<> X(n, p), AX(n, p), Ar(p, p), V(p, p), Y(n, p);
+    Vector<> lam(p), lamold(p), col(n), acol(n);
+
+    unsigned long seed = 12345;
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < p; j++)
+        {
+          seed = seed * 6364136223846793005ul + 1442695040888963407ul;
+          X(i,j) = double(seed >> 11) / double(1ul << 53) - 0.5;
+        }
+    lamold = 0.0;
+
+    for (m_iterations = 1; m_iterations <= maxsteps; m_iterations++)
+      {
+        for (size_t j = 0; j < p; j++)
+          {
+            col = X.col(j);
+            solveShifted(col);
+            X.col(j) = col;
+          }
+
+        // orthonormalize by modified Gram-Schmidt, twice for stability
+        for (int pass = 0; pass < 2; pass++)
+          for (size_t j = 0; j < p; j++)
+            {
+              for (size_t l = 0; l < j; l++)
+                {
+                  double dot = 0;
+                  for (size_t i = 0; i < n; i++) dot += X(i,l)*X(i,j);
+                  for (size_t i = 0; i < n; i++) X(i,j) -= dot*X(i,l);
+                }
+              double nrm = norm(X.col(j));
+              for (size_t i = 0; i < n; i++) X(i,j) /= nrm;
+            }
+
+        // Rayleigh-Ritz: Ar = X^T A X
+        for (size_t j = 0; j < p; j++)
+          {
+            col = X.col(j);
+            applyA(col, acol);
+            AX.col(j) = acol;
+          }
+        for (size_t i = 0; i < p; i++)
+          for (size_t j = 0; j < p; j++)
+            {
+              double sum = 0;
+              for (size_t l = 0; l < n; l++) sum += X(l,i)*AX(l,j);
+              Ar(i,j) = sum;
+            }
+        for (size_t i = 0; i < p; i++)
+          for (size_t j = i+1; j < p; j++)
+            Ar(i,j) = Ar(j,i) = 0.5*(Ar(i,j)+Ar(j,i));
+        SymmetricEigen(Ar, lam, V);
+
+        // X = X V, the Ritz vectors
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = 0; j < p; j++)
+            {
+              double sum = 0;
+              for (size_t l = 0; l < p; l++) sum += X(i,l)*V(l,j);
+              Y(i,j) = sum;
+            }
+        X = Y;
+
+        double change = 0, scale = 0;
+        for (size_t j = 0; j < k; j++)
+          {
+            change = std::max(change, std::abs(lam(j)-lamold(j)));
+            scale = std::max(scale, std::abs(lam(j)));
+          }
+        lamold = lam;
+        if (change <= tol * std::max(scale, shift))
+          break;
+      }
+    if (m_iterations > maxsteps)
+      throw std::domain_error("ModalROM: subspace iteration did not converge");
+
+    // Phi = M^{-1/2} X,  reduced force Phi^T M f(x0) = X^T M^{1/2} f(x0)
+    Vector<> f0(n);
+    func.evaluate(x0, f0);
+    for (size_t j = 0; j < k; j++)
+      {
+        m_omega2(j) = lam(j);
+        double sum = 0;
+        for (size_t i = 0; i < n; i++)
+          {
+            m_modes(i,j) = X(i,j) / sqm(i);
+            sum += X(i,j) * sqm(i) * f0(i);
+          }
+        m_force(j) = sum;
+      }
+  }
+
+  size_t numModes() const { return m_omega2.size(); }
+  int iterations() const { return m_iterations; }
+  VectorView<double> omega2() const { return m_omega2; }
+  MatrixView<double> modes() const { return m_modes; }
+
+  // x = x0 + Phi q
+  void lift (VectorView<double> q, VectorView<double> x) const
+  {
+    x = m_x0;
+    for (size_t i = 0; i < x.size(); i++)
+      {
+        double sum = 0;
+        for (size_t j = 0; j < numModes(); j++)
+          sum += m_modes(i,j) * q(j);
+        x(i) += sum;
+      }
+  }
+
+  // q = Phi^T M (x - x0), the M-orthogonal projection onto the modes
+  void project (VectorView<double> x, VectorView<double> q) const
+  {
+    q = 0.0;
+    for (size_t i = 0; i < x.size(); i++)
+      {
+        double mx = m_mass(i) * (x(i) - m_x0(i));
+        for (size_t j = 0; j < numModes(); j++)
+          q(j) += m_modes(i,j) * mx;
+      }
+  }
+
+  // dq = Phi^T M dx, for velocities and accelerations
+  void projectDerivative (VectorView<double> dx, VectorView<double> dq) const
+  {
+    dq = 0.0;
+    for (size_t i = 0; i < dx.size(); i++)
+      for (size_t j = 0; j < numModes(); j++)
+        dq(j) += m_modes(i,j) * m_mass(i) * dx(i);
+  }
+
+  // right hand side of the reduced system, mass matrix is the identity
+  std::shared_ptr<NonlinearFunction> reducedFunction () const
+  {
+    return std::make_shared<ModalFunction>(m_omega2, m_force);
+  }
+};
+
+#endif // MODAL_ROM_HPP
@@ -0,0 +1,193 @@
+#ifndef MSS_CONSTRAINTS_HPP
+#define MSS_CONSTRAINTS_HPP
+
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+
+#include <constrained.hpp>
+#include "mass_spring.hpp"
+
+
+// Mass-spring system with distance constraints (rigid rods) as a
+// ConstrainedSystem, for SolveConstrained_Alpha. Constraint c between
+// nodes i and j of rod length L is
+//   g_c = (|x_j-x_i|^2 - L^2) / (2L),   dg_c/dx_j = (x_j-x_i)/L = -dg_c/dx_i
+template <int D>
+class MSS_Constrained : public ConstrainedSystem
+{
+  const MassSpringSystem<D> & mss;
+  MSS_Function<D> m_func;
+
+  double coord (const CompiledMSS<D> & cmss, VectorView<double> q, size_t node, int d) const
+  { return node < cmss.nmasses ? q(node*D+d) : cmss.fixpos[d][node-cmss.nmasses]; }
+
+public:
+  MSS_Constrained (const MassSpringSystem<D> & _mss)
+    : mss(_mss), m_func(_mss) { }
+
+  virtual size_t dimQ() const override { return D*mss.masses().size(); }
+  virtual size_t dimC() const override { return mss.constraints().size(); }
+
+  virtual void massDiag (VectorView<double> m) const override
+  {
+    auto & cmss = mss.compiled();
+    for (size_t i = 0; i < dimQ(); i++)
+      m(i) = 1.0 / cmss.invmass[i/D];
+  }
+
+  // spring forces and gravity, M * MSS_Function
+  virtual void forces (VectorView<double> q, VectorView<double> f) const override
+  {
+    auto & cmss = mss.compiled();
+    m_func.evaluate(q, f);
+    for (size_t i = 0; i < dimQ(); i++)
+      f(i) /= cmss.invmass[i/D];
+  }
+
+  virtual void constraints (VectorView<double> q, VectorView<double> g) const override
+  {
+    auto & cmss = mss.compiled();
+    for (size_t c = 0; c < cmss.nconstraints(); c++)
+      {
+        double r2 = 0;
+        for (int d = 0; d < D; d++)
+          {
+            double diff = coord(cmss, q, cmss.cnode2[c], d) - coord(cmss, q, cmss.cnode1[c], d);
+            r2 += diff*diff;
+          }
+        double L = cmss.clength[c];
+        g(c) = (r2 - L*L) / (2*L);
+      }
+  }
+
+  virtual void constraintJacobian (VectorView<double> q, SparseMatrix & G) const override
+  {
+    auto & cmss = mss.compiled();
+    size_t nm = cmss.nmasses;
+    G.clear(dimQ());
+    for (size_t c = 0; c < cmss.nconstraints(); c++)
+      {
+        G.appendRow();
+        size_t i = cmss.cnode1[c], j = cmss.cnode2[c];
+        double L = cmss.clength[c];
+        for (int d = 0; d < D; d++)
+          {
+            double diff = (coord(cmss, q, j, d) - coord(cmss, q, i, d)) / L;
+            if (i < nm) G.add(i*D+d, -diff);
+            if (j < nm) G.add(j*D+d, diff);
+          }
+      }
+  }
+
+  // SHAKE: moves x back onto the constraints along the rod directions
+  // of the reference positions xref,  x -= M^{-1} G(xref)^T mu.
+  // mu is found by quasi-Newton steps with the Schur complement of G(xref)
+  // (matrix SHAKE), which converges in a few steps also for rigid trusses,
+  // where the rod by rod Gauss-Seidel version stalls.
+  // tol is relative to the rod lengths, returns the number of steps.
+  int projectPositions (VectorView<double> xref, VectorView<double> x,
+                        double tol = 1e-12, int maxsteps = 50) const
+  {
+    auto & cmss = mss.compiled();
+    size_t n = dimQ(), m = dimC();
+    Vector<> minv(n), g(m), mu(m), tmpq(n);
+    for (size_t i = 0; i < n; i++)
+      minv(i) = cmss.invmass[i/D];
+    SparseMatrix G(n);
+    constraintJacobian(xref, G);
+
+    for (int it = 0; it < maxsteps; it++)
+      {
+        constraints(x, g);
+        double err = 0;
+        for (size_t c = 0; c < m; c++)
+          err = std::max(err, std::abs(g(c)) / cmss.clength[c]);
+        if (err <= tol) return it;
+
+        SolveSchurCG(G, minv, g, mu, 1e-14, 1000, redundancy_reg);
+        G.multTrans(mu, tmpq);
+        for (size_t i = 0; i < n; i++)
+          x(i) -= minv(i) * tmpq(i);
+      }
+    throw std::domain_error("MSS_Constrained::projectPositions did not converge");
+  }
+
+  // RATTLE: removes the velocity components along the rods at x,
+  // G(x) v = 0 with  v -= M^{-1} G^T mu
+  void projectVelocities (VectorView<double> x, VectorView<double> v, int steps = 2) const
+  {
+    auto & cmss = mss.compiled();
+    size_t n = dimQ(), m = dimC();
+    Vector<> minv(n), gv(m), mu(m), tmpq(n);
+    for (size_t i = 0; i < n; i++)
+      minv(i) = cmss.invmass[i/D];
+    SparseMatrix G(n);
+    constraintJacobian(x, G);
+
+    // a second step cleans up the regularization error
+    for (int it = 0; it < steps; it++)
+      {
+        G.mult(v, gv);
+        SolveSchurCG(G, minv, gv, mu, 1e-14, 1000, redundancy_reg);
+        G.multTrans(mu, tmpq);
+        for (size_t i = 0; i < n; i++)
+          v(i) -= minv(i) * tmpq(i);
+      }
+  }
+
+  // Schur complement regularization, for redundant constraints
+  static constexpr double redundancy_reg = 1e-10;
+};
+
+
+// Velocity Verlet with SHAKE/RATTLE for a mass-spring system with
+// distance constraints: after the drift the positions are projected onto
+// the constraints, after the kick the velocities onto their tangent space.
+// Explicit, the step size is limited by the springs only (CriticalTimeStep),
+// rigid rods do not restrict it. ddx returns the constrained accelerations.
+template <int D>
+void SolveODE_RATTLE (double tend, int steps,
+                      VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
+                      const MassSpringSystem<D> & mss,
+                      std::function<void(double,VectorView<double>)> callback = nullptr,
+                      double tol = 1e-12)
+{
+  double dt = tend/steps;
+  MSS_Function<D> func(mss);
+  MSS_Constrained<D> csys(mss);
+
+  size_t n = x.size();
+  Vector<> a(n), xold(n), vhalf(n), correction(n);
+
+  // start on the constraint manifold
+  xold = x;
+  csys.projectPositions(xold, x, tol);
+  csys.projectVelocities(x, dx);
+  func.evaluate(x, a);
+
+  double t = 0;
+  for (int i = 0; i < steps; i++)
+    {
+      xold = x;
+      dx += dt/2 * a;
+      x += dt * dx;
+
+      // the position correction changes the half step velocity as well
+      correction = x;
+      csys.projectPositions(xold, x, tol);
+      correction -= x;
+      dx -= (1.0/dt) * correction;
+
+      vhalf = dx;
+      func.evaluate(x, a);
+      dx += dt/2 * a;
+      csys.projectVelocities(x, dx);
+      ddx = (2.0/dt) * (dx - vhalf);
+
+      t += dt;
+      if (callback) callback(t, x);
+    }
+}
+
+#endif // MSS_CONSTRAINTS_HPP
@@ -0,0 +1,104 @@
+#ifndef MSS_ENERGY_HPP
+#define MSS_ENERGY_HPP
+
+#include <array>
+#include <cmath>
+#include <memory>
+
+#include <energyfunction.hpp>
+#include "mass_spring.hpp"
+
+
+// A MassSpringSystem as potential energy
+//   E = sum_springs k/2 (|x_j-x_i| - l0)^2  -  sum_masses m g.x
+// for EnergyFunction: the elements are the springs, then the masses
+// (gravity). Forces and stiffness follow by AutoDiff, the equation of
+// motion is  M x'' = -grad E  with the mass matrix of MSS_MassMatrix:
+//
+//   auto rhs = MSS_EnergyFunction(mss);
+//   SolveODE_Alpha(tend, steps, rho, x, dx, ddx, rhs, MSS_MassMatrix(mss));
+//
+// Contact and distance constraints are not included.
+template <int D>
+class MSS_Energy
+{
+  const MassSpringSystem<D> & mss;
+public:
+  static constexpr size_t NL = 2*D;
+
+  MSS_Energy (const MassSpringSystem<D> & _mss) : mss(_mss) { }
+
+  size_t dimX() const { return D*mss.masses().size(); }
+  size_t numElements() const { return mss.springs().size() + mss.masses().size(); }
+
+  std::array<size_t,NL> elementDofs (size_t el) const
+  {
+    std::array<size_t,NL> dofs;
+    dofs.fill(NO_DOF);
+    size_t ns = mss.springs().size();
+    if (el < ns)
+      {
+        auto & con = mss.springs()[el].connectors;
+        for (int e = 0; e < 2; e++)
+          if (con[e].type == Connector::MASS)
+            for (int d = 0; d < D; d++)
+              dofs[e*D+d] = mss.dofNr(con[e].nr)*D+d;
+      }
+    else
+      for (int d = 0; d < D; d++)
+        dofs[d] = mss.dofNr(el-ns)*D+d;
+    return dofs;
+  }
+
+  template <typename T>
+  T T_energy (size_t el, const std::array<T,NL> & x) const
+  {
+    size_t ns = mss.springs().size();
+    if (el >= ns)
+      {
+        auto & m = mss.masses()[el-ns];
+        T e(0.0);
+        for (int d = 0; d < D; d++)
+          e -= m.mass * mss.getGravity()(d) * x[d];
+        return e;
+      }
+
+    auto & spring = mss.springs()[el];
+    auto & con = spring.connectors;
+    // end point coordinate, the fixes are constants
+    auto coord = [&] (int e, int d)
+    {
+      return con[e].type == Connector::MASS ? x[e*D+d] : T(mss.fixes()[con[e].nr].pos(d));
+    };
+    T r2(0.0);
+    for (int d = 0; d < D; d++)
+      {
+        T diff = coord(1,d) - coord(0,d);
+        r2 += diff*diff;
+      }
+    using std::sqrt;
+    T stretch = sqrt(r2) - spring.length;
+    return 0.5 * spring.stiffness * stretch * stretch;
+  }
+};
+
+
+template <int D>
+auto MSS_EnergyFunction (const MassSpringSystem<D> & mss)
+{
+  return std::make_shared<EnergyFunction<MSS_Energy<D>, MSS_Energy<D>::NL>>
+    (std::make_shared<MSS_Energy<D>>(mss));
+}
+
+// the diagonal mass matrix of the state vector
+template <int D>
+auto MSS_MassMatrix (const MassSpringSystem<D> & mss)
+{
+  Vector<> m(D*mss.masses().size());
+  for (size_t i = 0; i < mss.masses().size(); i++)
+    for (int d = 0; d < D; d++)
+      m(mss.dofNr(i)*D+d) = mss.masses()[i].mass;
+  return std::make_shared<DiagonalFunction>(m);
+}
+
+#endif // MSS_ENERGY_HPP
@@ -0,0 +1,76 @@
+// Cross-check of the energy formulation (mss_energy.hpp) against
+// MSS_Function on a crane truss with different masses: forces M a,
+// stiffness M J and a generalized alpha trajectory.
+//
+//   mss_energy_check
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "mss_energy.hpp"
+#include "mss_generators.hpp"
+#include "Newmark.hpp"
+
+
+int main ()
+{
+  constexpr int D = 2;
+  auto mss = MakeCrane<D>(10);
+  mss.setGravity(MakePoint<D>(0, -9.81));
+  for (size_t i = 0; i < mss.masses().size(); i++)
+    mss.masses()[i].mass = 1.0 + 0.1*(i % 7);
+  mss.renumberMasses();
+
+  size_t n = D*mss.masses().size();
+  Vector<> x(n), v(n), a(n);
+  mss.getState(x, v, a);
+  for (size_t i = 0; i < n; i++)
+    x(i) += 0.01*std::sin(1.3*i);
+
+  auto accel = std::make_shared<MSS_Function<D>>(mss);
+  auto energy = MSS_EnergyFunction(mss);
+  auto mass = MSS_MassMatrix(mss);
+  Vector<> m(n);
+  mass->evaluateDiagDeriv(x, m);
+
+  // forces: -grad E = M a
+  Vector<> fa(n), fe(n);
+  accel->evaluate(x, fa);
+  energy->evaluate(x, fe);
+  double ferr = 0, fscale = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      ferr = std::max(ferr, std::abs(fe(i) - m(i)*fa(i)));
+      fscale = std::max(fscale, std::abs(fe(i)));
+    }
+
+  // stiffness: -Hess E = M J
+  Matrix<> ja(n, n), je(n, n);
+  accel->evaluateDeriv(x, ja);
+  energy->evaluateDeriv(x, je);
+  double jerr = 0, jscale = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      {
+        jerr = std::max(jerr, std::abs(je(i,j) - m(i)*ja(i,j)));
+        jscale = std::max(jscale, std::abs(je(i,j)));
+      }
+
+  // trajectories: x'' = a(x)  and  M x'' = -grad E(x)
+  Vector<> x1 = x, v1(n), a1(n), x2 = x, v2(n), a2(n);
+  v1 = 0.0; v2 = 0.0;
+  accel->evaluate(x, a1);
+  a2 = a1;
+  SolveODE_Alpha(1.0, 200, 0.8, x1, v1, a1, accel, std::make_shared<IdentityFunction>(n));
+  SolveODE_Alpha(1.0, 200, 0.8, x2, v2, a2, energy, mass);
+  double xerr = 0;
+  for (size_t i = 0; i < n; i++)
+    xerr = std::max(xerr, std::abs(x1(i) - x2(i)));
+
+  std::printf("unknowns %zu\n", n);
+  std::printf("forces     rel. error %10.3e\n", ferr/fscale);
+  std::printf("stiffness  rel. error %10.3e\n", jerr/jscale);
+  std::printf("trajectory max. error %10.3e\n", xerr);
+  return 0;
+}
@@ -0,0 +1,150 @@
+#ifndef MSS_GENERATORS_HPP
+#define MSS_GENERATORS_HPP
+
+#include <cmath>
+#include <vector>
+
+#include "mass_spring.hpp"
+
+
+// Parametric test structures of arbitrary size. All of them are built in
+// the x-y plane (x-y-z for the lattice) and start at rest, gravity is left
+// to the caller.
+
+template <int D>
+Vec<D> MakePoint (double x, double y, double z = 0.0)
+{
+  Vec<D> p = 0.0;
+  p(0) = x;
+  if constexpr (D > 1) p(1) = y;
+  if constexpr (D > 2) p(2) = z;
+  return p;
+}
+
+
+// n masses in a straight line along x, hanging on a fix at the origin
+template <int D>
+MassSpringSystem<D> MakeChain (size_t n, double length = 1.0, double stiffness = 1000.0,
+                               double mass = 1.0)
+{
+  MassSpringSystem<D> mss;
+  Connector prev = mss.addFix({ MakePoint<D>(0, 0) });
+  for (size_t i = 1; i <= n; i++)
+    {
+      auto node = mss.addMass({ mass, MakePoint<D>(i*length, 0) });
+      mss.addSpring({ length, stiffness, {prev, node} });
+      prev = node;
+    }
+  return mss;
+}
+
+
+// truss with n segments, clamped at x = 0 by two fixes,
+// X-bracing in every segment and a heavy tip
+template <int D>
+MassSpringSystem<D> MakeCrane (size_t nsegments, double seglength = 1.0, double height = 1.0,
+                               double stiffness = 5000.0, double mass = 1.0, double tipmass = 10.0)
+{
+  MassSpringSystem<D> mss;
+  Connector prevbot = mss.addFix({ MakePoint<D>(0, 0) });
+  Connector prevtop = mss.addFix({ MakePoint<D>(0, height) });
+  double diaglength = std::sqrt(seglength*seglength + height*height);
+
+  for (size_t i = 1; i <= nsegments; i++)
+    {
+      double x = i * seglength;
+      double m = (i == nsegments) ? tipmass : mass;
+      auto bot = mss.addMass({ m, MakePoint<D>(x, 0) });
+      auto top = mss.addMass({ m, MakePoint<D>(x, height) });
+
+      mss.addSpring({ seglength, stiffness, {prevbot, bot} });
+      mss.addSpring({ seglength, stiffness, {prevtop, top} });
+      mss.addSpring({ height, stiffness, {bot, top} });
+      mss.addSpring({ diaglength, stiffness, {prevbot, top} });
+      mss.addSpring({ diaglength, stiffness, {prevtop, bot} });
+
+      prevbot = bot;
+      prevtop = top;
+    }
+  return mss;
+}
+
+
+// nx x ny grid of masses in the x-y plane with structural and shear springs,
+// hanging from fixes at the two upper corners
+template <int D>
+MassSpringSystem<D> MakeCloth (size_t nx, size_t ny, double spacing = 0.1,
+                               double stiffness = 1000.0, double mass = 0.01)
+{
+  MassSpringSystem<D> mss;
+  std::vector<Connector> nodes(nx*ny);
+  for (size_t j = 0; j < ny; j++)
+    for (size_t i = 0; i < nx; i++)
+      nodes[j*nx+i] = mss.addMass({ mass, MakePoint<D>(i*spacing, -double(j)*spacing) });
+
+  double diag = spacing * std::sqrt(2.0);
+  for (size_t j = 0; j < ny; j++)
+    for (size_t i = 0; i < nx; i++)
+      {
+        auto node = nodes[j*nx+i];
+        if (i+1 < nx)
+          mss.addSpring({ spacing, stiffness, {node, nodes[j*nx+i+1]} });
+        if (j+1 < ny)
+          mss.addSpring({ spacing, stiffness, {node, nodes[(j+1)*nx+i]} });
+        if (i+1 < nx && j+1 < ny)
+          {
+            mss.addSpring({ diag, stiffness, {node, nodes[(j+1)*nx+i+1]} });
+            mss.addSpring({ diag, stiffness, {nodes[j*nx+i+1], nodes[(j+1)*nx+i]} });
+          }
+      }
+
+  auto fixleft = mss.addFix({ MakePoint<D>(0, spacing) });
+  auto fixright = mss.addFix({ MakePoint<D>((nx-1)*spacing, spacing) });
+  mss.addSpring({ spacing, stiffness, {fixleft, nodes[0]} });
+  mss.addSpring({ spacing, stiffness, {fixright, nodes[nx-1]} });
+  return mss;
+}
+
+
+// nx x ny x nz block of masses standing on a layer of fixes at z = 0.
+// Springs along the cell edges and the four space diagonals of every cell.
+inline MassSpringSystem<3> MakeLattice (size_t nx, size_t ny, size_t nz, double spacing = 0.1,
+                                        double stiffness = 1000.0, double mass = 0.01)
+{
+  MassSpringSystem<3> mss;
+  // layer k = 0 are the fixes
+  std::vector<Connector> nodes(nx*ny*(nz+1));
+  auto index = [&] (size_t i, size_t j, size_t k) { return (k*ny+j)*nx+i; };
+
+  for (size_t k = 0; k <= nz; k++)
+    for (size_t j = 0; j < ny; j++)
+      for (size_t i = 0; i < nx; i++)
+        {
+          auto p = MakePoint<3>(i*spacing, j*spacing, k*spacing);
+          nodes[index(i,j,k)] = (k == 0) ? mss.addFix({ p }) : mss.addMass({ mass, p });
+        }
+
+  double diag = spacing * std::sqrt(3.0);
+  for (size_t k = 0; k <= nz; k++)
+    for (size_t j = 0; j < ny; j++)
+      for (size_t i = 0; i < nx; i++)
+        {
+          auto node = nodes[index(i,j,k)];
+          if (i+1 < nx && k > 0)
+            mss.addSpring({ spacing, stiffness, {node, nodes[index(i+1,j,k)]} });
+          if (j+1 < ny && k > 0)
+            mss.addSpring({ spacing, stiffness, {node, nodes[index(i,j+1,k)]} });
+          if (k+1 <= nz)
+            mss.addSpring({ spacing, stiffness, {node, nodes[index(i,j,k+1)]} });
+          if (i+1 < nx && j+1 < ny && k+1 <= nz)
+            {
+              mss.addSpring({ diag, stiffness, {node, nodes[index(i+1,j+1,k+1)]} });
+              mss.addSpring({ diag, stiffness, {nodes[index(i+1,j,k)], nodes[index(i,j+1,k+1)]} });
+              mss.addSpring({ diag, stiffness, {nodes[index(i,j+1,k)], nodes[index(i+1,j,k+1)]} });
+              mss.addSpring({ diag, stiffness, {nodes[index(i+1,j+1,k)], nodes[index(i,j,k+1)]} });
+            }
+        }
+  return mss;
+}
+
+#endif // MSS_GENERATORS_HPP
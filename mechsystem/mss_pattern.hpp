@@ -0,0 +1,209 @@
+#ifndef MSS_PATTERN_HPP
+#define MSS_PATTERN_HPP
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <skylinematrix.hpp>
+#include "mass_spring.hpp"
+
+
+// Sparsity pattern of the MSS_Function Jacobian together with its
+// symbolic factorization (the skyline profile, see SkylineMatrix), on the
+// level of masses in dof order. Follows the topology journal of the
+// MassSpringSystem: added or removed springs update the adjacency and
+// the profile in O(degree), only other changes (new dof numbers, direct
+// edits of the springs) trigger a full analysis.
+//
+//   MSS_Pattern<D> pattern(mss);
+//   mss.removeSpring(s);                 // e.g. a torn spring
+//   pattern.update();
+//   SkylineMatrix jac(pattern.skyline());
+//   func.evaluateSkylineDeriv(x, jac);
+//
+// The solvers get there through MSS_SkylineFunction below.
+template <int D>
+class MSS_Pattern
+{
+  const MassSpringSystem<D> & mss;
+  size_t m_version = 0;
+  bool m_valid = false;
+  // neighbors of a mass node with the number of springs between them
+  std::vector<std::vector<std::pair<size_t,size_t>>> m_adj;
+  std::vector<size_t> m_firstnode;   // smallest coupled node <= i
+  size_t m_rebuilds = 0, m_updates = 0;
+
+  // dof node of a spring end, or nothing for fixes
+  bool node (Connector c, size_t & nr) const
+  {
+    if (c.type != Connector::MASS) return false;
+    nr = mss.dofNr(c.nr);
+    return true;
+  }
+
+  void addEdge (size_t i, size_t j)
+  {
+    for (size_t k : { i, j })
+      {
+        size_t other = (k == i) ? j : i;
+        auto & adj = m_adj[k];
+        auto it = std::find_if(adj.begin(), adj.end(), [&] (auto & e) { return e.first == other; });
+        if (it != adj.end())
+          it->second++;
+        else
+          adj.push_back({ other, 1 });
+      }
+    size_t hi = std::max(i,j), lo = std::min(i,j);
+    m_firstnode[hi] = std::min(m_firstnode[hi], lo);
+  }
+
+  void removeEdge (size_t i, size_t j)
+  {
+    for (size_t k : { i, j })
+      {
+        size_t other = (k == i) ? j : i;
+        auto & adj = m_adj[k];
+        auto it = std::find_if(adj.begin(), adj.end(), [&] (auto & e) { return e.first == other; });
+        if (it == adj.end()) continue;
+        if (--it->second == 0)
+          {
+            *it = adj.back();
+            adj.pop_back();
+            if (m_firstnode[k] == other)
+              {
+                m_firstnode[k] = k;
+                for (auto & e : adj)
+                  m_firstnode[k] = std::min(m_firstnode[k], e.first);
+              }
+          }
+      }
+  }
+
+  void springEdge (const std::array<Connector,2> & con, bool add)
+  {
+    size_t i, j;
+    if (!node(con[0], i) || !node(con[1], j) || i == j) return;
+    if (add)
+      addEdge(i, j);
+    else
+      removeEdge(i, j);
+  }
+
+  void rebuild ()
+  {
+    size_t n = mss.masses().size();
+    m_adj.assign(n, { });
+    m_firstnode.resize(n);
+    for (size_t i = 0; i < n; i++)
+      m_firstnode[i] = i;
+    for (auto & sp : mss.springs())
+      springEdge(sp.connectors, true);
+    m_rebuilds++;
+  }
+
+public:
+  MSS_Pattern (const MassSpringSystem<D> & _mss) : mss(_mss) { update(); }
+
+  // brings the pattern up to date with the system,
+  // returns true if a full analysis was necessary
+  bool update ()
+  {
+    if (m_valid && m_version == mss.topologyVersion()
+        && m_adj.size() == mss.masses().size())
+      return false;
+
+    bool incremental = m_valid && mss.forChangesSince(m_version, [&] (const TopologyChange & c)
+    {
+      switch (c.kind)
+        {
+        case TopologyChange::MASS_ADDED:
+          m_adj.emplace_back();
+          m_firstnode.push_back(m_firstnode.size());
+          break;
+        case TopologyChange::SPRING_ADDED:
+          springEdge(c.connectors, true); break;
+        case TopologyChange::SPRING_REMOVED:
+          springEdge(c.connectors, false); break;
+        case TopologyChange::RESET:
+          m_valid = false; break;
+        default:
+          break;
+        }
+    });
+    // the journal might have been applied halfway before a reset
+    incremental = incremental && m_valid && m_adj.size() == mss.masses().size();
+    if (incremental)
+      m_updates++;
+    else
+      rebuild();
+
+    m_version = mss.topologyVersion();
+    m_valid = true;
+    return !incremental;
+  }
+
+  size_t numRebuilds() const { return m_rebuilds; }
+  size_t numUpdates() const { return m_updates; }
+
+  // masses (dof nodes) coupled to mass node i by springs
+  template <typename F>
+  void forNeighbors (size_t i, F f) const
+  {
+    for (auto & e : m_adj[i]) f(e.first);
+  }
+
+  // number of nonzero entries of the Jacobian
+  size_t nnz () const
+  {
+    size_t nb = m_adj.size();
+    for (auto & adj : m_adj) nb += adj.size();
+    return D*D*nb;
+  }
+
+  // max |i-j| of coupled dofs, the bandwidth for BandMatrix
+  size_t bandwidth () const
+  {
+    size_t bw = 0;
+    for (size_t i = 0; i < m_firstnode.size(); i++)
+      bw = std::max(bw, i-m_firstnode[i]);
+    return D*(bw+1)-1;
+  }
+
+  // first column of every dof row, the profile for SkylineMatrix
+  std::vector<size_t> skyline () const
+  {
+    std::vector<size_t> firstcol(D*m_firstnode.size());
+    for (size_t i = 0; i < m_firstnode.size(); i++)
+      for (int d = 0; d < D; d++)
+        firstcol[i*D+d] = m_firstnode[i]*D;
+    return firstcol;
+  }
+};
+
+
+// MSS_Function with the profile of an MSS_Pattern as skylineProfile():
+// Linearization, and with it NewtonSolver and the implicit time steppers,
+// assemble and factor the Jacobian in the skyline profile, which follows
+// added and removed springs incrementally. With contacts there is no
+// profile, the solvers fall back to the band or dense Jacobian.
+template <int D>
+class MSS_SkylineFunction : public MSS_Function<D>
+{
+  const MassSpringSystem<D> & mss;
+  mutable MSS_Pattern<D> m_pattern;
+public:
+  MSS_SkylineFunction (const MassSpringSystem<D> & _mss)
+    : MSS_Function<D>(_mss), mss(_mss), m_pattern(_mss) { }
+
+  const MSS_Pattern<D> & pattern() const { return m_pattern; }
+
+  std::vector<size_t> skylineProfile() const override
+  {
+    if (mss.getContactRadius() > 0) return { };
+    m_pattern.update();
+    return m_pattern.skyline();
+  }
+};
+
+#endif // MSS_PATTERN_HPP
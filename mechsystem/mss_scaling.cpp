@@ -0,0 +1,148 @@
+// Scaling benchmark: times force evaluation (in double and float),
+// Jacobian assembly and one implicit (generalized alpha) step for the
+// generated structures from 10 up to 10^6 masses.
+//
+// The masses are renumbered by Reverse Cuthill-McKee, Newton then uses a
+// banded LU when the Jacobian is narrow (UseBandedJacobian). The Jacobian
+// is assembled as a band, or in the skyline profile of MSS_Pattern, up to
+// max_band_entries stored entries, else dense up to max_dense_jacobian
+// unknowns. The implicit step runs up to
+// max_dense_step unknowns or max_band_work = n bw^2 for banded systems.
+// Larger systems print "-". A step whose Newton iteration fails stops the
+// benchmark with an error.
+//
+//   mss_scaling [maxmasses]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "mss_generators.hpp"
+#include "mss_pattern.hpp"
+#include "Newmark.hpp"
+
+constexpr size_t max_dense_jacobian = 4000;
+constexpr double max_band_entries = 5e7;
+constexpr size_t max_dense_step = 1000;
+constexpr double max_band_work = 1e10;
+
+
+// seconds per call, repeated until at least mintime has passed
+double TimeIt (const std::function<void()> & f, double mintime = 0.2)
+{
+  using clock = std::chrono::steady_clock;
+  size_t runs = 0;
+  auto start = clock::now();
+  double elapsed = 0;
+  do
+    {
+      f();
+      runs++;
+      elapsed = std::chrono::duration<double>(clock::now()-start).count();
+    }
+  while (elapsed < mintime);
+  return elapsed / runs;
+}
+
+
+template <int D>
+void Benchmark (const std::string & name, MassSpringSystem<D> mss)
+{
+  mss.setGravity(MakePoint<D>(0, -9.81));
+  mss.renumberMasses();
+  size_t nmasses = mss.masses().size();
+  size_t n = D*nmasses;
+
+  Vector<> x(n), v(n), a(n), f(n);
+  mss.getState(x, v, a);
+  auto rhs = std::make_shared<MSS_Function<D>>(mss);
+  auto mass = std::make_shared<IdentityFunction>(n);
+
+  // non-const springs() forces a full compile
+  double tcompile = TimeIt([&] { mss.springs(); mss.compiled(); }, 0.0);
+  double teval = TimeIt([&] { rhs->evaluate(x, f); });
+  auto mss32 = ConvertScalar<float>(mss);
+  MSS_Function<D,float> rhs32(mss32);
+  double teval32 = TimeIt([&] { rhs32.evaluate(x, f); });
+
+  std::string jac = "-", step = "-";
+  char buf[64];
+  size_t bw = rhs->bandwidth();
+  bool banded = UseBandedJacobian(*rhs);
+  double tjac = 0;
+  if (banded && double(n)*(3*bw+1) <= max_band_entries)
+    {
+      BandMatrix df(n, bw);
+      tjac = TimeIt([&] { rhs->evaluateBandDeriv(x, df); });
+    }
+  else if (banded)
+    {
+      auto profile = MSS_Pattern<D>(mss).skyline();
+      double entries = n;
+      for (size_t i = 0; i < n; i++)
+        entries += 2.0 * (i-profile[i]);
+      if (entries <= max_band_entries)
+        {
+          SkylineMatrix df(std::move(profile));
+          tjac = TimeIt([&] { rhs->evaluateSkylineDeriv(x, df); });
+        }
+    }
+  else if (n <= max_dense_jacobian)
+    {
+      Matrix<> df(n, n);
+      tjac = TimeIt([&] { rhs->evaluateDeriv(x, df); });
+    }
+  if (tjac > 0)
+    {
+      std::snprintf(buf, sizeof(buf), "%12.3e", nmasses/tjac);
+      jac = buf;
+    }
+  if (n <= max_dense_step || (banded && double(n)*bw*bw <= max_band_work))
+    {
+      double tstep = TimeIt([&]
+      {
+        Vector<> xs = x, vs = v, as = a;
+        SolveODE_Alpha(1e-3, 1, 0.8, xs, vs, as, rhs, mass);
+      });
+      std::snprintf(buf, sizeof(buf), "%12.3e", nmasses/tstep);
+      step = buf;
+    }
+
+  std::printf("%-8s %10zu %10zu %12.3e %12.3e %12.3e %12s %12s\n", name.c_str(),
+              nmasses, std::as_const(mss).springs().size(), tcompile, nmasses/teval, nmasses/teval32,
+              jac.c_str(), step.c_str());
+}
+
+
+int main (int argc, char * argv[])
+try
+{
+  size_t maxmasses = (argc > 1) ? std::atol(argv[1]) : 1000000;
+
+  std::printf("%-8s %10s %10s %12s %12s %12s %12s %12s\n", "scene", "masses", "springs",
+              "compile[s]", "eval[m/s]", "eval32[m/s]", "jacobi[m/s]", "step[m/s]");
+
+  for (size_t size = 10; size <= maxmasses; size *= 10)
+    {
+      size_t side2 = std::max<size_t>(2, std::lround(std::sqrt(double(size))));
+      size_t side3 = std::max<size_t>(2, std::lround(std::cbrt(double(size))));
+
+      Benchmark("chain", MakeChain<2>(size));
+      Benchmark("crane", MakeCrane<2>(size/2));
+      Benchmark("cloth2d", MakeCloth<2>(side2, side2));
+      Benchmark("cloth3d", MakeCloth<3>(side2, side2));
+      Benchmark("lattice", MakeLattice(side3, side3, side3));
+    }
+  return 0;
+}
+catch (std::exception & e)
+{
+  std::fprintf(stderr, "error: %s\n", e.what());
+  return 1;
+}
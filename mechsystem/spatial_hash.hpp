@@ -0,0 +1,114 @@
+#ifndef SPATIAL_HASH_HPP
+#define SPATIAL_HASH_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+
+// Uniform grid for neighbor search. Points are hashed to cells of size h,
+// buckets are stored as CSR (counting sort), so build and query are O(n)
+// for bounded point density. The cell of every point is remembered, and a
+// rebuild is skipped when no point changed its cell.
+template <int D>
+class SpatialHash
+{
+  double m_cellsize = 0;
+  size_t m_tablesize = 0;
+  std::vector<uint64_t> m_bucket;         // bucket of every point
+  std::vector<int64_t> m_cell;            // cell coordinates of every point
+  std::vector<size_t> m_firstinbucket, m_points;
+
+  uint64_t hash (const int64_t * cell) const
+  {
+    static constexpr uint64_t primes[3] = { 73856093, 19349663, 83492791 };
+    uint64_t h = 0;
+    for (int d = 0; d < D; d++)
+      h ^= uint64_t(cell[d]) * primes[d];
+    return h & (m_tablesize-1);
+  }
+
+public:
+  // points are given by coordinate arrays pos[d][0..n)
+  void build (const std::array<std::vector<double>,D> & pos, size_t n, double cellsize)
+  {
+    bool rebuild = (cellsize != m_cellsize || n != m_bucket.size());
+    if (rebuild)
+      {
+        m_cellsize = cellsize;
+        m_tablesize = 1;
+        while (m_tablesize < 2*n) m_tablesize *= 2;
+        m_bucket.resize(n);
+        m_cell.resize(D*n);
+      }
+
+    for (size_t i = 0; i < n; i++)
+      {
+        int64_t cell[D];
+        for (int d = 0; d < D; d++)
+          cell[d] = int64_t(std::floor(pos[d][i] / m_cellsize));
+        for (int d = 0; d < D; d++)
+          if (cell[d] != m_cell[D*i+d])
+            {
+              rebuild = true;
+              m_cell[D*i+d] = cell[d];
+            }
+      }
+    if (!rebuild) return;
+
+    m_firstinbucket.assign(m_tablesize+1, 0);
+    for (size_t i = 0; i < n; i++)
+      {
+        m_bucket[i] = hash(&m_cell[D*i]);
+        m_firstinbucket[m_bucket[i]+1]++;
+      }
+    for (size_t b = 0; b < m_tablesize; b++)
+      m_firstinbucket[b+1] += m_firstinbucket[b];
+    m_points.resize(n);
+    std::vector<size_t> cnt(m_firstinbucket.begin(), m_firstinbucket.end()-1);
+    for (size_t i = 0; i < n; i++)
+      m_points[cnt[m_bucket[i]]++] = i;
+  }
+
+  // f(i, j) once for every pair i < j closer than the cell size
+  template <typename F>
+  void forAllPairs (const std::array<std::vector<double>,D> & pos, F f) const
+  {
+    constexpr int nneighbors = (D == 1) ? 3 : (D == 2) ? 9 : 27;
+    double h2 = m_cellsize*m_cellsize;
+
+    for (size_t i = 0; i < m_bucket.size(); i++)
+      {
+        // distinct buckets of the neighboring cells
+        uint64_t buckets[nneighbors];
+        int nb = 0;
+        for (int k = 0; k < nneighbors; k++)
+          {
+            int64_t cell[D];
+            int rest = k;
+            for (int d = 0; d < D; d++, rest /= 3)
+              cell[d] = m_cell[D*i+d] + rest%3 - 1;
+            uint64_t b = hash(cell);
+            bool found = false;
+            for (int l = 0; l < nb; l++)
+              if (buckets[l] == b) found = true;
+            if (!found) buckets[nb++] = b;
+          }
+
+        for (int l = 0; l < nb; l++)
+          for (size_t k = m_firstinbucket[buckets[l]]; k < m_firstinbucket[buckets[l]+1]; k++)
+            {
+              size_t j = m_points[k];
+              if (j <= i) continue;
+              double r2 = 0;
+              for (int d = 0; d < D; d++)
+                r2 += (pos[d][j]-pos[d][i]) * (pos[d][j]-pos[d][i]);
+              if (r2 < h2)
+                f(i, j);
+            }
+      }
+  }
+};
+
+#endif // SPATIAL_HASH_HPP
@@ -0,0 +1,251 @@
+#ifndef XPBD_HPP
+#define XPBD_HPP
+
+#include <array>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "mass_spring.hpp"
+
+
+// Extended position based dynamics (XPBD) for a MassSpringSystem:
+// a spring is a distance constraint  C = |x_j-x_i| - l0  with compliance
+// 1/k, a DistanceConstraint one with compliance 0. Every frame is split
+// into substeps; a substep predicts x += h v (with gravity) and projects
+// the constraints with a fixed number of Gauss-Seidel sweeps:
+//
+//   dlambda = (-C - alpha lambda) / (w_i + w_j + alpha),  alpha = 1/(k h^2)
+//   x_i -= w_i dlambda n,  x_j += w_j dlambda n,          n = (x_j-x_i)/|x_j-x_i|
+//
+// then v = (x - xold)/h. The cost per frame is fixed, substeps*iterations
+// sweeps over the springs, no Jacobian and no linear solve. The springs of
+// one color (see CompiledMSS) share no mass and are projected in parallel.
+//
+// Contacts (setContact) are inequality constraints  |x_j-x_i| >= 2R  with
+// compliance 1/k_contact, between masses closer than 2R after the
+// prediction of a substep that no spring connects (as in MSS_Function).
+// They only push apart and are projected serially after the springs.
+template <int D>
+class XPBD_Solver
+{
+  const MassSpringSystem<D> & mss;
+  int m_substeps, m_iterations;
+  std::vector<double> m_pos;       // node positions, masses then fixes
+  std::vector<double> m_oldpos;
+  std::vector<double> m_lambda;    // spring multipliers of the current substep
+  std::array<std::vector<double>,D> m_hashpos;   // mass positions by component
+  SpatialHash<D> m_hash;
+  std::vector<std::array<size_t,2>> m_contacts;  // close pairs of the current substep
+  std::vector<double> m_clambda;
+
+  static constexpr size_t parallel_threshold = 10000;
+
+  // correction of the springs [first, next), all of one color
+  void projectSprings (const CompiledMSS<D> & cmss, size_t first, size_t next, double h2inv)
+  {
+    size_t nm = cmss.nmasses;
+    for (size_t s = first; s < next; s++)
+      {
+        size_t i = cmss.node1[s], j = cmss.node2[s];
+        double * pi = &m_pos[i*D];
+        double * pj = &m_pos[j*D];
+        double n[D];
+        double r2 = 0;
+        for (int d = 0; d < D; d++)
+          {
+            n[d] = pj[d]-pi[d];
+            r2 += n[d]*n[d];
+          }
+        double r = std::sqrt(r2);
+        if (r < 1e-12) continue;
+
+        double wi = cmss.invmass[i], wj = cmss.invmass[j];
+        double alpha = h2inv / cmss.stiffness[s];
+        double dlambda = (-(r - cmss.length[s]) - alpha*m_lambda[s]) / (wi + wj + alpha);
+        m_lambda[s] += dlambda;
+        double fac = dlambda / r;
+        for (int d = 0; d < D; d++)
+          {
+            if (i < nm) pi[d] -= wi*fac*n[d];
+            if (j < nm) pj[d] += wj*fac*n[d];
+          }
+      }
+  }
+
+  // rigid rods, serial, usually few
+  void projectConstraints (const CompiledMSS<D> & cmss)
+  {
+    size_t nm = cmss.nmasses;
+    for (size_t c = 0; c < cmss.nconstraints(); c++)
+      {
+        size_t i = cmss.cnode1[c], j = cmss.cnode2[c];
+        double * pi = &m_pos[i*D];
+        double * pj = &m_pos[j*D];
+        double n[D];
+        double r2 = 0;
+        for (int d = 0; d < D; d++)
+          {
+            n[d] = pj[d]-pi[d];
+            r2 += n[d]*n[d];
+          }
+        double r = std::sqrt(r2);
+        double wi = cmss.invmass[i], wj = cmss.invmass[j];
+        if (r < 1e-12 || wi+wj == 0) continue;
+
+        double fac = -(r - cmss.clength[c]) / ((wi + wj) * r);
+        for (int d = 0; d < D; d++)
+          {
+            if (i < nm) pi[d] -= wi*fac*n[d];
+            if (j < nm) pj[d] += wj*fac*n[d];
+          }
+      }
+  }
+
+  // pairs of masses closer than dist that no spring connects
+  void findContacts (const CompiledMSS<D> & cmss, double dist)
+  {
+    size_t nm = cmss.nmasses;
+    for (int d = 0; d < D; d++)
+      {
+        m_hashpos[d].resize(nm);
+        for (size_t i = 0; i < nm; i++)
+          m_hashpos[d][i] = m_pos[i*D+d];
+      }
+    m_contacts.clear();
+    m_hash.build(m_hashpos, nm, dist);
+    m_hash.forAllPairs(m_hashpos, [&] (size_t i, size_t j)
+    {
+      for (size_t l = cmss.firstspring[i]; l < cmss.firstspring[i+1]; l++)
+        {
+          size_t s = cmss.adjsprings[l];
+          if (cmss.node1[s] == j || cmss.node2[s] == j) return;
+        }
+      m_contacts.push_back({ i, j });
+    });
+    m_clambda.assign(m_contacts.size(), 0.0);
+  }
+
+  // C = |x_j-x_i| - dist, only while negative
+  void projectContacts (const CompiledMSS<D> & cmss, double dist, double alpha)
+  {
+    for (size_t c = 0; c < m_contacts.size(); c++)
+      {
+        auto [i, j] = m_contacts[c];
+        double * pi = &m_pos[i*D];
+        double * pj = &m_pos[j*D];
+        double n[D];
+        double r2 = 0;
+        for (int d = 0; d < D; d++)
+          {
+            n[d] = pj[d]-pi[d];
+            r2 += n[d]*n[d];
+          }
+        double r = std::sqrt(r2);
+        if (r < 1e-12 || r >= dist) continue;
+
+        double wi = cmss.invmass[i], wj = cmss.invmass[j];
+        double dlambda = (-(r - dist) - alpha*m_clambda[c]) / (wi + wj + alpha);
+        m_clambda[c] += dlambda;
+        double fac = dlambda / r;
+        for (int d = 0; d < D; d++)
+          {
+            pi[d] -= wi*fac*n[d];
+            pj[d] += wj*fac*n[d];
+          }
+      }
+  }
+
+public:
+  XPBD_Solver (const MassSpringSystem<D> & _mss, int substeps = 10, int iterations = 1)
+    : mss(_mss), m_substeps(substeps), m_iterations(iterations) { }
+
+  // advances the state (getState order) by one frame of length dt,
+  // a gets the acceleration (v - vold)/h of the last substep
+  void frame (double dt, VectorView<double> x, VectorView<double> v, VectorView<double> a)
+  {
+    auto & cmss = mss.compiled();
+    size_t nm = cmss.nmasses;
+    size_t ns = cmss.nsprings();
+    double h = dt / m_substeps;
+    double h2inv = 1.0 / (h*h);
+    Vec<D> gravity = mss.getGravity();
+    bool parallel = ns >= parallel_threshold && TaskManager::instance().numThreads() > 1;
+    double cdist = 2*mss.getContactRadius();
+    bool contacts = cdist > 0 && mss.getContactStiffness() > 0;
+    double calpha = contacts ? h2inv / mss.getContactStiffness() : 0;
+
+    m_pos.resize(D*cmss.nnodes);
+    for (size_t k = 0; k < D*nm; k++)
+      m_pos[k] = x(k);
+    for (size_t i = nm; i < cmss.nnodes; i++)
+      for (int d = 0; d < D; d++)
+        m_pos[i*D+d] = cmss.fixpos[d][i-nm];
+    m_oldpos.resize(D*nm);
+    m_lambda.resize(ns);
+
+    for (int sub = 0; sub < m_substeps; sub++)
+      {
+        for (size_t i = 0; i < nm; i++)
+          for (int d = 0; d < D; d++)
+            {
+              size_t k = i*D+d;
+              m_oldpos[k] = m_pos[k];
+              a(k) = v(k);
+              v(k) += h * gravity(d);
+              m_pos[k] += h * v(k);
+            }
+
+        std::fill(m_lambda.begin(), m_lambda.end(), 0.0);
+        if (contacts)
+          findContacts(cmss, cdist);
+        for (int it = 0; it < m_iterations; it++)
+          {
+            for (size_t c = 0; c < cmss.ncolors(); c++)
+              {
+                size_t first = cmss.firstincolor[c], next = cmss.firstincolor[c+1];
+                if (parallel)
+                  ParallelForRange (next-first, [&] (size_t lo, size_t hi)
+                  {
+                    projectSprings(cmss, first+lo, first+hi, h2inv);
+                  });
+                else
+                  projectSprings(cmss, first, next, h2inv);
+              }
+            projectConstraints(cmss);
+            if (contacts)
+              projectContacts(cmss, cdist, calpha);
+          }
+
+        for (size_t k = 0; k < D*nm; k++)
+          {
+            v(k) = (m_pos[k] - m_oldpos[k]) / h;
+            a(k) = (v(k) - a(k)) / h;
+          }
+      }
+
+    for (size_t k = 0; k < D*nm; k++)
+      x(k) = m_pos[k];
+  }
+};
+
+
+// steps frames of XPBD on [0, tend], callback after every frame,
+// ddx returns the acceleration of the last substep
+template <int D>
+void SolveODE_XPBD (double tend, int steps, VectorView<double> x, VectorView<double> dx,
+                    VectorView<double> ddx, const MassSpringSystem<D> & mss, int substeps = 10, int iterations = 1,
+                    std::function<void(double,VectorView<double>)> callback = nullptr)
+{
+  double dt = tend/steps;
+  XPBD_Solver<D> solver(mss, substeps, iterations);
+  double t = 0;
+  for (int i = 0; i < steps; i++)
+    {
+      solver.frame(dt, x, dx, ddx);
+      t += dt;
+      if (callback) callback(t, x);
+    }
+}
+
+#endif // XPBD_HPP
@@ -1,33 +1,117 @@
 #ifndef Newton_h
 #define Newton_h
 
+#include <memory>
+#include <stdexcept>
+
 #include "nonlinfunc.hpp"
 #include <inverse.hpp>
 #include <lapack_interface.hpp>
 
 namespace ASC_ode
 {
+  // square Jacobians with a narrow band are solved by banded LU.
+  // evaluateBandDeriv may still return false, then the dense path is used.
+  inline bool UseBandedJacobian (const NonlinearFunction & func)
+  {
+    size_t n = func.dimX();
+    return func.dimF() == n && 4*(2*func.bandwidth()+1) < n;
+  }
+
+
+  // Jacobian func'(x), for products and for solves with many right hand
+  // sides (e.g. sensitivities dy/dp). It is factored once, at the first
+  // solve; mult only before that. Skyline LU if the function provides a
+  // profile (e.g. MSS_SkylineFunction), banded LU for narrow bands (see
+  // UseBandedJacobian), else dense. NewtonSolver solves with it, too.
+  class Linearization
+  {
+    bool m_factored = false;
+    std::unique_ptr<SkylineMatrix> m_skyline;
+    std::unique_ptr<BandMatrix> m_band;
+    std::unique_ptr<Matrix<double>> m_dense;
+  public:
+    Linearization (std::shared_ptr<NonlinearFunction> func, VectorView<double> x)
+    {
+      auto profile = func->skylineProfile();
+      if (!profile.empty() && func->dimF() == func->dimX())
+        {
+          m_skyline = std::make_unique<SkylineMatrix>(std::move(profile));
+          if (func->evaluateSkylineDeriv(x, *m_skyline)) return;
+          m_skyline.reset();
+        }
+      if (UseBandedJacobian(*func))
+        {
+          m_band = std::make_unique<BandMatrix>(func->dimX(), func->bandwidth());
+          if (func->evaluateBandDeriv(x, *m_band)) return;
+          m_band.reset();   // band not available after all
+        }
+      m_dense = std::make_unique<Matrix<double>>(func->dimF(), func->dimX());
+      func->evaluateDeriv(x, *m_dense);
+    }
+
+    bool banded() const { return bool(m_band); }
+    bool skyline() const { return bool(m_skyline); }
+
+    // y = func'(x) v
+    void mult (VectorView<double> v, VectorView<double> y) const
+    {
+      if (m_factored)
+        throw std::logic_error("Linearization::mult after solve");
+      if (m_skyline)
+        m_skyline->mult(v, y);
+      else if (m_band)
+        m_band->mult(v, y);
+      else
+        y = (*m_dense) * v;
+    }
+
+    // b = func'(x)^{-1} b
+    void solve (VectorView<double> b)
+    {
+      if (!m_factored)
+        {
+          if (m_skyline)
+            m_skyline->factor();
+          else if (m_band)
+            m_band->factor();
+          else
+            calcInverse(*m_dense);
+          m_factored = true;
+        }
+      if (m_skyline)
+        m_skyline->solve(b);
+      else if (m_band)
+        m_band->solve(b);
+      else
+        {
+          Vector<double> tmp = (*m_dense) * b;
+          b = tmp;
+        }
+    }
+  };
+
+
+  // converged at  |res| < tol * max(1, |res_0|),  relative to the first
+  // residual: large systems (or large forces) carry round-off in res far
+  // above an absolute 1e-10
   void NewtonSolver (std::shared_ptr<NonlinearFunction> func, VectorView<double> x,
                      double tol = 1e-10, int maxsteps = 10,
                      std::function<void(int,double,VectorView<double>)> callback = nullptr)
   {
     Vector<double> res(func->dimF());
-    Matrix<double> fprime(func->dimF(), func->dimX());
+    double scale = 1;
 
     for (int i = 0; i < maxsteps; i++)
       {
         func->evaluate(x, res);
         double err= norm(res);
-        if (err < tol) return;
-
-        func->evaluateDeriv(x, fprime);
-
-        calcInverse(fprime);
-        x -= fprime*res;
+        if (i == 0) scale = std::max(1.0, err);
+        if (err < tol*scale) return;
 
-        // LapackLU LU(fprime);
-        // LU.solve(res);
-        // x -= res;
+        Linearization fprime(func, x);
+        fprime.solve(res);
+        x -= res;
 
         if (callback)
           callback(i, err, x);
@@ -0,0 +1,136 @@
+#ifndef ADFUNCTION_HPP
+#define ADFUNCTION_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "autodiff.hpp"
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  // Base for functions written once as
+  //   template <typename T> void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  // evaluate and evaluateDeriv (by AutoDiff) are derived from it:
+  //
+  //   class Pendulum : public ADFunction<Pendulum, 2> { ... T_evaluate ... };
+  //
+  // Columns of the Jacobian without a common row are seeded into the same
+  // derivative lane (Curtis-Powell-Reid colouring), so a sparse Jacobian
+  // costs about as many lanes as it has colours, not dimX. The pattern is
+  // taken from Derived::jacobianPattern() (the columns of every row) if
+  // there is one, else from bandwidth(), else it is dense. The colours are
+  // evaluated LANES at a time with AutoDiff<LANES>.
+  template <typename Derived, size_t NX, size_t NF = NX, size_t LANES = std::min<size_t>(NX, 8)>
+  class ADFunction : public NonlinearFunction
+  {
+    mutable bool m_analyzed = false;
+    mutable std::vector<std::vector<size_t>> m_rowcols;   // pattern by rows
+    mutable std::vector<size_t> m_color;                  // colour of every column
+    mutable size_t m_ncolors = 0;
+
+    const Derived & derived() const { return static_cast<const Derived&>(*this); }
+
+    // pattern and greedy colouring, columns sharing a row differ in colour
+    void analyze () const
+    {
+      if (m_analyzed) return;
+      if constexpr (requires (const Derived & d) { d.jacobianPattern(); })
+        m_rowcols = derived().jacobianPattern();
+      else
+        {
+          size_t bw = std::min(derived().bandwidth(), NX);
+          m_rowcols.assign(NF, { });
+          for (size_t i = 0; i < NF; i++)
+            for (size_t j = (i > bw ? i-bw : 0); j < std::min(NX, i+bw+1); j++)
+              m_rowcols[i].push_back(j);
+        }
+
+      std::vector<std::vector<size_t>> colrows(NX);
+      for (size_t i = 0; i < m_rowcols.size(); i++)
+        for (size_t j : m_rowcols[i])
+          colrows[j].push_back(i);
+
+      m_color.assign(NX, 0);
+      std::vector<size_t> forbidden(NX, size_t(-1));   // column which forbids the colour
+      m_ncolors = 0;
+      for (size_t j = 0; j < NX; j++)
+        {
+          for (size_t i : colrows[j])
+            for (size_t k : m_rowcols[i])
+              if (k < j) forbidden[m_color[k]] = j;
+          size_t c = 0;
+          while (forbidden[c] == j) c++;
+          m_color[j] = c;
+          m_ncolors = std::max(m_ncolors, c+1);
+        }
+      m_analyzed = true;
+    }
+
+    // calls set(i, j, df_i/dx_j) for all entries of the pattern
+    template <typename SET>
+    void jacobianEntries (VectorView<double> x, SET set) const
+    {
+      analyze();
+      Vector<AutoDiff<LANES>> x_ad(NX);
+      Vector<AutoDiff<LANES>> f_ad(NF);
+      for (size_t first = 0; first < m_ncolors; first += LANES)
+        {
+          for (size_t j = 0; j < NX; j++)
+            {
+              x_ad(j) = AutoDiff<LANES>(x(j));
+              if (m_color[j] >= first && m_color[j] < first+LANES)
+                x_ad(j).deriv()[m_color[j]-first] = 1.0;
+            }
+          derived().template T_evaluate<AutoDiff<LANES>>(x_ad, f_ad);
+
+          for (size_t i = 0; i < m_rowcols.size(); i++)
+            for (size_t j : m_rowcols[i])
+              if (m_color[j] >= first && m_color[j] < first+LANES)
+                set(i, j, f_ad(i).deriv()[m_color[j]-first]);
+        }
+    }
+
+  public:
+    size_t dimX() const override { return NX; }
+    size_t dimF() const override { return NF; }
+
+    // number of seed lanes needed for the Jacobian
+    size_t numColors() const
+    {
+      analyze();
+      return m_ncolors;
+    }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      derived().template T_evaluate<double>(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      jacobianEntries(x, [&] (size_t i, size_t j, double v) { df(i,j) = v; });
+    }
+
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      if (NF != NX) return false;
+      df.setZero();
+      bool inband = true;
+      jacobianEntries(x, [&] (size_t i, size_t j, double v)
+      {
+        if (df.inBand(i,j))
+          df(i,j) = v;
+        else if (v != 0.0)
+          inband = false;
+      });
+      return inband;
+    }
+  };
+
+}
+
+#endif
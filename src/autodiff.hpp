@@ -1,10 +1,19 @@
 #ifndef AUTODIFF_HPP
 #define AUTODIFF_HPP
 
+#include <cassert>
 #include <cstddef>
 #include <ostream>
 #include <cmath>
+#include <algorithm>
 #include <array>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "simd.hpp"
 
 
 namespace ASC_ode
@@ -24,29 +33,215 @@ namespace ASC_ode
   auto derivative (T v, size_t /*index*/) { return T(0); }
 
 
+  // Derivative storage of AutoDiff. For double and float it is aligned and
+  // padded to whole SIMD registers, the padding lanes stay 0, so all
+  // expressions below are evaluated register by register without a
+  // remainder loop. Other scalars (nested AutoDiff) use one lane.
+  template <size_t N, typename T>
+  class ADDerivs
+  {
+  public:
+    static constexpr size_t W = std::is_same_v<T,double> ? SIMD_DOUBLE_WIDTH
+      : std::is_same_v<T,float> ? SIMD_FLOAT_WIDTH : 1;
+    static constexpr size_t NP = (N == 0) ? W : (N+W-1)/W*W;
+  private:
+    alignas(W == 1 ? alignof(T) : W*sizeof(T)) T m_data[NP];
+  public:
+    ADDerivs () : m_data{} { }
+
+    static constexpr size_t size() { return N; }
+    T & operator[] (size_t i) { return m_data[i]; }
+    const T & operator[] (size_t i) const { return m_data[i]; }
+    T * data() { return m_data; }
+    const T * data() const { return m_data; }
+    T * begin() { return m_data; }
+    T * end() { return m_data+N; }
+    const T * begin() const { return m_data; }
+    const T * end() const { return m_data+N; }
+  };
+
+
+  // Lazy AutoDiff expressions. An operator computes the value of its
+  // result right away, but only records how the derivatives combine
+  // (c*a', a'+b', ca*a'+cb*b'). Assigning the expression to an AutoDiff
+  // evaluates all derivative lanes of the whole tree in one pass, without
+  // N-sized temporaries. Named AutoDiffs are referenced, so an expression
+  // must not outlive its operands: assign it to an AutoDiff, don't keep it
+  // in an auto variable.
+  //
+  // A node provides dim, value_type, value() and block<S>(i), the
+  // derivative lanes i ... i+|S|-1 as SIMD register S (or as T for one lane).
+  template <typename E>
+  struct ADExpr { };
+
+  template <size_t N, typename T> class AutoDiff;
+
+  template <typename E>
+  struct is_autodiff : std::false_type { };
+  template <size_t N, typename T>
+  struct is_autodiff<AutoDiff<N,T>> : std::true_type { };
+
+  template <typename E>
+  constexpr bool is_ad_expr_v = std::is_base_of_v<ADExpr<std::decay_t<E>>, std::decay_t<E>>;
+
+  // how a node keeps an operand: named AutoDiffs by reference,
+  // temporaries and sub-expressions by value
+  template <typename E>
+  using ADOperand = std::conditional_t<std::is_lvalue_reference_v<E> && is_autodiff<std::decay_t<E>>::value,
+                                       const std::decay_t<E>&, std::decay_t<E>>;
+
+  template <typename E>
+  using ADValueType = typename std::decay_t<E>::value_type;
+
+
+  // d = c * a'
+  template <typename A>
+  class ADScaled : public ADExpr<ADScaled<A>>
+  {
+  public:
+    static constexpr size_t dim = std::decay_t<A>::dim;
+    using value_type = typename std::decay_t<A>::value_type;
+  private:
+    A m_a;
+    value_type m_val, m_c;
+  public:
+    ADScaled (A a, value_type val, value_type c)
+      : m_a(std::forward<A>(a)), m_val(val), m_c(c) { }
+    value_type value() const { return m_val; }
+    template <typename S>
+    S block (size_t i) const { return S(m_c) * m_a.template block<S>(i); }
+  };
+
+  // d = a', a shifted by a constant
+  template <typename A>
+  class ADShifted : public ADExpr<ADShifted<A>>
+  {
+  public:
+    static constexpr size_t dim = std::decay_t<A>::dim;
+    using value_type = typename std::decay_t<A>::value_type;
+  private:
+    A m_a;
+    value_type m_val;
+  public:
+    ADShifted (A a, value_type val) : m_a(std::forward<A>(a)), m_val(val) { }
+    value_type value() const { return m_val; }
+    template <typename S>
+    S block (size_t i) const { return m_a.template block<S>(i); }
+  };
+
+  // d = a' + b'  or  a' - b'
+  template <typename A, typename B, bool MINUS>
+  class ADSum : public ADExpr<ADSum<A,B,MINUS>>
+  {
+  public:
+    static constexpr size_t dim = std::decay_t<A>::dim;
+    using value_type = typename std::decay_t<A>::value_type;
+  private:
+    A m_a;
+    B m_b;
+    value_type m_val;
+  public:
+    ADSum (A a, B b, value_type val)
+      : m_a(std::forward<A>(a)), m_b(std::forward<B>(b)), m_val(val) { }
+    value_type value() const { return m_val; }
+    template <typename S>
+    S block (size_t i) const
+    {
+      if constexpr (MINUS)
+        return m_a.template block<S>(i) - m_b.template block<S>(i);
+      else
+        return m_a.template block<S>(i) + m_b.template block<S>(i);
+    }
+  };
+
+  // d = ca * a' + cb * b'
+  template <typename A, typename B>
+  class ADLinear : public ADExpr<ADLinear<A,B>>
+  {
+  public:
+    static constexpr size_t dim = std::decay_t<A>::dim;
+    using value_type = typename std::decay_t<A>::value_type;
+  private:
+    A m_a;
+    B m_b;
+    value_type m_val, m_ca, m_cb;
+  public:
+    ADLinear (A a, B b, value_type val, value_type ca, value_type cb)
+      : m_a(std::forward<A>(a)), m_b(std::forward<B>(b)), m_val(val), m_ca(ca), m_cb(cb) { }
+    value_type value() const { return m_val; }
+    template <typename S>
+    S block (size_t i) const
+    { return S(m_ca) * m_a.template block<S>(i) + S(m_cb) * m_b.template block<S>(i); }
+  };
+
+
   template <size_t N, typename T = double>
-  class AutoDiff
+  class AutoDiff : public ADExpr<AutoDiff<N,T>>
   {
+  public:
+    static constexpr size_t dim = N;
+    using value_type = T;
   private:
     T m_val;
-    std::array<T, N> m_deriv;
+    ADDerivs<N, T> m_deriv;
+
+    // the fused pass, lane i only reads lane i of the leaves,
+    // so x = x*y is fine
+    template <typename E>
+    void assign (const E & e)
+    {
+      static_assert(E::dim == N, "AutoDiff: mixed numbers of derivatives");
+      constexpr size_t W = ADDerivs<N,T>::W;
+      m_val = e.value();
+      if constexpr (W == 1)
+        for (size_t i = 0; i < N; i++)
+          m_deriv[i] = e.template block<T>(i);
+      else
+        for (size_t i = 0; i < ADDerivs<N,T>::NP; i += W)
+          e.template block<SIMD<T,W>>(i).store(m_deriv.data()+i);
+    }
+
+    template <typename E>
+    static constexpr bool is_node_v = is_ad_expr_v<E> && !is_autodiff<std::decay_t<E>>::value;
+
   public:
-    AutoDiff () : m_val(0), m_deriv{} {}
-    AutoDiff (T v) : m_val(v), m_deriv{}
+    AutoDiff () : m_val(0) {}
+    AutoDiff (T v) : m_val(v)
     {
-      for (size_t i = 0; i < N; i++)
-        m_deriv[i] = derivative(v, i);
+      // constants have no derivative, a nested AutoDiff passes its own on
+      if constexpr (!std::is_arithmetic_v<T>)
+        for (size_t i = 0; i < N; i++)
+          m_deriv[i] = derivative(v, i);
     }
 
     template <size_t I>
-    AutoDiff (Variable<I, T> var) : m_val(var.value()), m_deriv{}
+    AutoDiff (Variable<I, T> var) : m_val(var.value())
     {
       m_deriv[I] = 1.0;
     }
 
+    template <typename E, typename = std::enable_if_t<is_node_v<E> && std::is_same_v<ADValueType<E>,T>>>
+    AutoDiff (const E & e) { assign(e); }
+
+    template <typename E, typename = std::enable_if_t<is_node_v<E> && std::is_same_v<ADValueType<E>,T>>>
+    AutoDiff & operator= (const E & e)
+    {
+      assign(e);
+      return *this;
+    }
+
     T value() const { return m_val; }
-    std::array<T, N>& deriv() { return m_deriv; }
-    const std::array<T, N>& deriv() const { return m_deriv; }
+    ADDerivs<N, T>& deriv() { return m_deriv; }
+    const ADDerivs<N, T>& deriv() const { return m_deriv; }
+
+    template <typename S>
+    S block (size_t i) const
+    {
+      if constexpr (std::is_same_v<S,T>)
+        return m_deriv[i];
+      else
+        return S::load(m_deriv.data()+i);
+    }
   };
 
 
@@ -56,6 +251,23 @@ namespace ASC_ode
     return v.deriv()[index];
   }
 
+  // plain value of a number or a (nested) AutoDiff
+  template <typename T>
+  double ScalarValue (const T & v)
+  {
+    if constexpr (std::is_arithmetic_v<T>)
+      return double(v);
+    else
+      return ScalarValue(v.value());
+  }
+
+  // evaluates an expression
+  template <typename E>
+  auto Eval (const E & e)
+  {
+    return AutoDiff<E::dim, typename E::value_type>(e);
+  }
+
 
 
   template <size_t N, typename T>
@@ -71,131 +283,757 @@ namespace ASC_ode
     return os;
   }
 
-  template <size_t N, typename T = double>
-  AutoDiff<N, T> operator+ (const AutoDiff<N, T>& a, const AutoDiff<N, T>& b)
+  template <typename E, typename = std::enable_if_t<is_ad_expr_v<E> && !is_autodiff<E>::value>>
+  std::ostream & operator<< (std::ostream& os, const E & e)
   {
-     AutoDiff<N, T> result(a.value() + b.value());
-     for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = a.deriv()[i] + b.deriv()[i];
-       return result;
-   }
+    return os << Eval(e);
+  }
 
-  template <size_t N, typename T = double>
-  auto operator+ (T a, const AutoDiff<N, T>& b) { return AutoDiff<N, T>(a) + b; }
 
+  template <typename A, typename B>
+  using ADEnableBinary = std::enable_if_t<is_ad_expr_v<A> && is_ad_expr_v<B>>;
+  template <typename A>
+  using ADEnable = std::enable_if_t<is_ad_expr_v<A>>;
 
 
-  template <size_t N, typename T = double>
-  AutoDiff<N, T> operator* (const AutoDiff<N, T>& a, const AutoDiff<N, T>& b)
+  template <typename A, typename B, typename = ADEnableBinary<A,B>>
+  auto operator+ (A && a, B && b)
+  {
+    auto val = a.value() + b.value();
+    return ADSum<ADOperand<A&&>, ADOperand<B&&>, false> (std::forward<A>(a), std::forward<B>(b), val);
+  }
+
+  template <typename A, typename = ADEnable<A>>
+  auto operator+ (A && a, ADValueType<A> s)
   {
-       AutoDiff<N, T> result(a.value() * b.value());
-       for (size_t i = 0; i < N; i++)
-          result.deriv()[i] = a.deriv()[i] * b.value() + a.value() * b.deriv()[i];
-       return result;
+    auto val = a.value() + s;
+    return ADShifted<ADOperand<A&&>> (std::forward<A>(a), val);
+  }
+
+  template <typename B, typename = ADEnable<B>>
+  auto operator+ (ADValueType<B> s, B && b) { return std::forward<B>(b) + s; }
+
+
+  template <typename A, typename B, typename = ADEnableBinary<A,B>>
+  auto operator* (A && a, B && b)
+  {
+    auto va = a.value();
+    auto vb = b.value();
+    return ADLinear<ADOperand<A&&>, ADOperand<B&&>> (std::forward<A>(a), std::forward<B>(b), va*vb, vb, va);
   }
 
     //Added in minus operator, scalar multiplication and division
 
     // Subtraction: a - b
-  template <size_t N, typename T>
-  AutoDiff<N,T> operator-(const AutoDiff<N,T>& a, const AutoDiff<N,T>& b)
+  template <typename A, typename B, typename = ADEnableBinary<A,B>>
+  auto operator- (A && a, B && b)
   {
-    AutoDiff<N,T> result(a.value() - b.value());
-    for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = a.deriv()[i] - b.deriv()[i];
-    return result;
+    auto val = a.value() - b.value();
+    return ADSum<ADOperand<A&&>, ADOperand<B&&>, true> (std::forward<A>(a), std::forward<B>(b), val);
+  }
+
+  template <typename A, typename = ADEnable<A>>
+  auto operator- (A && a, ADValueType<A> s)
+  {
+    auto val = a.value() - s;
+    return ADShifted<ADOperand<A&&>> (std::forward<A>(a), val);
+  }
+
+  template <typename B, typename = ADEnable<B>>
+  auto operator- (ADValueType<B> s, B && b)
+  {
+    using T = ADValueType<B>;
+    auto val = s - b.value();
+    return ADScaled<ADOperand<B&&>> (std::forward<B>(b), val, T(-1));
   }
 
   // Unary minus: -a
-  template <size_t N, typename T>
-  AutoDiff<N,T> operator-(const AutoDiff<N,T>& a)
+  template <typename A, typename = ADEnable<A>>
+  auto operator- (A && a)
   {
-    AutoDiff<N,T> result(-a.value());
-    for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = -a.deriv()[i];
-    return result;
+    using T = ADValueType<A>;
+    auto val = -a.value();
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), val, T(-1));
   }
 
   // Division: a / b
-  template <size_t N, typename T>
-  AutoDiff<N,T> operator/(const AutoDiff<N,T>& a, const AutoDiff<N,T>& b)
+  template <typename A, typename B, typename = ADEnableBinary<A,B>>
+  auto operator/ (A && a, B && b)
+  {
+    using T = ADValueType<A>;
+    T val_a = a.value(), val_b = b.value();
+    T inv_b = T(1) / val_b;
+
+    // (a' b - a b') / b^2
+    return ADLinear<ADOperand<A&&>, ADOperand<B&&>> (std::forward<A>(a), std::forward<B>(b),
+                                                     val_a / val_b, inv_b, -val_a * inv_b * inv_b);
+  }
+
+  template <typename A, typename = ADEnable<A>>
+  auto operator/ (A && a, ADValueType<A> s)
+  {
+    using T = ADValueType<A>;
+    auto val = a.value() / s;
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), val, T(1) / s);
+  }
+
+  template <typename B, typename = ADEnable<B>>
+  auto operator/ (ADValueType<B> s, B && b)
   {
+    using T = ADValueType<B>;
     T val_b = b.value();
-    AutoDiff<N,T> result(a.value() / val_b);
+    T inv_b = T(1) / val_b;
+    return ADScaled<ADOperand<B&&>> (std::forward<B>(b), s / val_b, -s * inv_b * inv_b);
+  }
 
-    for (size_t i = 0; i < N; i++)
-    {
-        result.deriv()[i] =
-            (a.deriv()[i] * val_b - a.value() * b.deriv()[i]) / (val_b * val_b);
-    }
-    return result;
+  template <size_t N, typename T, typename B>
+  AutoDiff<N,T> & operator+= (AutoDiff<N,T>& a, B && b)
+  {
+    a = a + std::forward<B>(b);
+    return a;
+  }
+
+  template <size_t N, typename T, typename B>
+  AutoDiff<N,T> & operator-= (AutoDiff<N,T>& a, B && b)
+  {
+    a = a - std::forward<B>(b);
+    return a;
   }
 
 
   // Multiplication with scalar: a * s
-  template <size_t N, typename T>
-  AutoDiff<N,T> operator*(const AutoDiff<N,T>& a, const T& s)
+  template <typename A, typename = ADEnable<A>>
+  auto operator* (A && a, ADValueType<A> s)
   {
-    AutoDiff<N,T> result(a.value() * s);
-    for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = a.deriv()[i] * s;
-    return result;
+    auto val = a.value() * s;
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), val, s);
   }
 
   // Multiplication with scalar: s * a
-  template <size_t N, typename T>
-  AutoDiff<N,T> operator*(const T& s, const AutoDiff<N,T>& a)
+  template <typename B, typename = ADEnable<B>>
+  auto operator* (ADValueType<B> s, B && b)
   {
-    return a * s;  // reuse the implementation above
+    return std::forward<B>(b) * s;  // reuse the implementation above
   }
 
    using std::sin;
    using std::cos;
    using std::exp;
    using std::log;
+   using std::sqrt;
 
-   template <size_t N, typename T = double>
-   AutoDiff<N, T> sin(const AutoDiff<N, T> &a)
+   template <typename A, typename = ADEnable<A>>
+   auto sin (A && a)
    {
-       AutoDiff<N, T> result(sin(a.value()));
-       for (size_t i = 0; i < N; i++)
-           result.deriv()[i] = cos(a.value()) * a.deriv()[i];
-       return result;
+       auto va = a.value();
+       return ADScaled<ADOperand<A&&>> (std::forward<A>(a), sin(va), cos(va));
    }
 
    // adding in the cosine, log and exponential operators
 
-   template <size_t N, typename T = double>
-   AutoDiff<N,T> cos(const AutoDiff<N,T>& a)
+   template <typename A, typename = ADEnable<A>>
+   auto cos (A && a)
    {
-    AutoDiff<N,T> result(cos(a.value()));
-    for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = -sin(a.value()) * a.deriv()[i];
-    return result;
+    auto va = a.value();
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), cos(va), -sin(va));
     }
 
-    template <size_t N, typename T>
-    AutoDiff<N,T> exp(const AutoDiff<N,T>& a)
+    template <typename A, typename = ADEnable<A>>
+    auto exp (A && a)
     {
-    T val = exp(a.value());
-    AutoDiff<N,T> result(val);
-    for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = val * a.deriv()[i];
-    return result;
+    ADValueType<A> val = exp(a.value());
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), val, val);
     }
 
-    template <size_t N, typename T>
-    AutoDiff<N,T> log(const AutoDiff<N,T>& a)
+    template <typename A, typename = ADEnable<A>>
+    auto sqrt (A && a)
     {
-    AutoDiff<N,T> result(log(a.value()));
+    using T = ADValueType<A>;
+    T val = sqrt(a.value());
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), val, T(1) / (2*val));
+    }
+
+    template <typename A, typename = ADEnable<A>>
+    auto log (A && a)
+    {
+    using T = ADValueType<A>;
+    T va = a.value();
+    return ADScaled<ADOperand<A&&>> (std::forward<A>(a), log(va), T(1) / va);
+    }
+
+
+  // Second order forward AD: value, gradient and the symmetric Hessian by
+  // N variables. The Hessian is packed by rows of its lower triangle,
+  // N(N+1)/2 entries instead of N^2 for a nested AutoDiff<N,AutoDiff<N>>.
+  template <size_t N, typename T = double>
+  class AutoDiff2
+  {
+  public:
+    static constexpr size_t hsize = N*(N+1)/2;
+  private:
+    T m_val;
+    std::array<T,N> m_grad;
+    std::array<T,hsize> m_hess;   // H(i,j) = m_hess[i*(i+1)/2+j], j <= i
+  public:
+    AutoDiff2 () : m_val(0), m_grad{}, m_hess{} { }
+    AutoDiff2 (T v) : m_val(v), m_grad{}, m_hess{} { }
+
+    template <size_t I>
+    AutoDiff2 (Variable<I, T> var) : m_val(var.value()), m_grad{}, m_hess{}
+    {
+      m_grad[I] = 1.0;
+    }
+
+    T value() const { return m_val; }
+    std::array<T,N> & grad() { return m_grad; }
+    const std::array<T,N> & grad() const { return m_grad; }
+    std::array<T,hsize> & hess() { return m_hess; }
+    const std::array<T,hsize> & hess() const { return m_hess; }
+    T hessian (size_t i, size_t j) const
+    { return i >= j ? m_hess[i*(i+1)/2+j] : m_hess[j*(j+1)/2+i]; }
+
+    // f(a) by the chain rule, d1 = f'(a), d2 = f''(a)
+    static AutoDiff2 chain (T v, T d1, T d2, const AutoDiff2 & a)
+    {
+      AutoDiff2 r(v);
+      for (size_t i = 0, k = 0; i < N; i++)
+        {
+          r.m_grad[i] = d1 * a.m_grad[i];
+          for (size_t j = 0; j <= i; j++, k++)
+            r.m_hess[k] = d1 * a.m_hess[k] + d2 * a.m_grad[i] * a.m_grad[j];
+        }
+      return r;
+    }
+
+    // f(a,b) with first partials fa, fb and second partials faa, fab, fbb
+    static AutoDiff2 chain (T v, T fa, T fb, T faa, T fab, T fbb,
+                            const AutoDiff2 & a, const AutoDiff2 & b)
+    {
+      AutoDiff2 r(v);
+      for (size_t i = 0, k = 0; i < N; i++)
+        {
+          T gai = a.m_grad[i], gbi = b.m_grad[i];
+          r.m_grad[i] = fa * gai + fb * gbi;
+          for (size_t j = 0; j <= i; j++, k++)
+            {
+              T gaj = a.m_grad[j], gbj = b.m_grad[j];
+              r.m_hess[k] = fa * a.m_hess[k] + fb * b.m_hess[k]
+                + faa * gai * gaj + fab * (gai * gbj + gbi * gaj) + fbb * gbi * gbj;
+            }
+        }
+      return r;
+    }
+  };
+
+  template <size_t N, typename T>
+  std::ostream & operator<< (std::ostream& os, const AutoDiff2<N, T>& ad)
+  {
+    os << "Value: " << ad.value() << ", Grad: [";
     for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = a.deriv()[i] / a.value();
-    return result;
+      os << ad.grad()[i] << (i+1 < N ? ", " : "");
+    os << "], Hess: [";
+    for (size_t k = 0; k < AutoDiff2<N,T>::hsize; k++)
+      os << ad.hess()[k] << (k+1 < AutoDiff2<N,T>::hsize ? ", " : "");
+    os << "]";
+    return os;
+  }
+
+  template <size_t N, typename T>
+  auto operator+ (const AutoDiff2<N,T> & a, const AutoDiff2<N,T> & b)
+  { return AutoDiff2<N,T>::chain(a.value()+b.value(), T(1), T(1), T(0), T(0), T(0), a, b); }
+
+  template <size_t N, typename T>
+  auto operator- (const AutoDiff2<N,T> & a, const AutoDiff2<N,T> & b)
+  { return AutoDiff2<N,T>::chain(a.value()-b.value(), T(1), T(-1), T(0), T(0), T(0), a, b); }
+
+  template <size_t N, typename T>
+  auto operator* (const AutoDiff2<N,T> & a, const AutoDiff2<N,T> & b)
+  { return AutoDiff2<N,T>::chain(a.value()*b.value(), b.value(), a.value(), T(0), T(1), T(0), a, b); }
+
+  template <size_t N, typename T>
+  auto operator/ (const AutoDiff2<N,T> & a, const AutoDiff2<N,T> & b)
+  {
+    T inv_b = T(1) / b.value();
+    T q = a.value() * inv_b;
+    return AutoDiff2<N,T>::chain(a.value()/b.value(), inv_b, -q*inv_b,
+                                 T(0), -inv_b*inv_b, 2*q*inv_b*inv_b, a, b);
+  }
+
+  template <size_t N, typename T>
+  auto operator- (const AutoDiff2<N,T> & a)
+  { return AutoDiff2<N,T>::chain(-a.value(), T(-1), T(0), a); }
+
+  template <size_t N, typename T>
+  auto operator+ (const AutoDiff2<N,T> & a, std::type_identity_t<T> s)
+  { return AutoDiff2<N,T>::chain(a.value()+s, T(1), T(0), a); }
+  template <size_t N, typename T>
+  auto operator+ (std::type_identity_t<T> s, const AutoDiff2<N,T> & a) { return a + s; }
+
+  template <size_t N, typename T>
+  auto operator- (const AutoDiff2<N,T> & a, std::type_identity_t<T> s)
+  { return AutoDiff2<N,T>::chain(a.value()-s, T(1), T(0), a); }
+  template <size_t N, typename T>
+  auto operator- (std::type_identity_t<T> s, const AutoDiff2<N,T> & a)
+  { return AutoDiff2<N,T>::chain(s-a.value(), T(-1), T(0), a); }
+
+  template <size_t N, typename T>
+  auto operator* (const AutoDiff2<N,T> & a, std::type_identity_t<T> s)
+  { return AutoDiff2<N,T>::chain(a.value()*s, s, T(0), a); }
+  template <size_t N, typename T>
+  auto operator* (std::type_identity_t<T> s, const AutoDiff2<N,T> & a) { return a * s; }
+
+  template <size_t N, typename T>
+  auto operator/ (const AutoDiff2<N,T> & a, std::type_identity_t<T> s)
+  { return AutoDiff2<N,T>::chain(a.value()/s, T(1)/s, T(0), a); }
+  template <size_t N, typename T>
+  auto operator/ (std::type_identity_t<T> s, const AutoDiff2<N,T> & a)
+  {
+    T inv = T(1) / a.value();
+    return AutoDiff2<N,T>::chain(s/a.value(), -s*inv*inv, 2*s*inv*inv*inv, a);
+  }
+
+  template <size_t N, typename T>
+  AutoDiff2<N,T> & operator+= (AutoDiff2<N,T> & a, const AutoDiff2<N,T> & b) { return a = a + b; }
+  template <size_t N, typename T>
+  AutoDiff2<N,T> & operator-= (AutoDiff2<N,T> & a, const AutoDiff2<N,T> & b) { return a = a - b; }
+
+  template <size_t N, typename T>
+  auto sin (const AutoDiff2<N,T> & a)
+  {
+    T s = sin(a.value()), c = cos(a.value());
+    return AutoDiff2<N,T>::chain(s, c, -s, a);
+  }
+
+  template <size_t N, typename T>
+  auto cos (const AutoDiff2<N,T> & a)
+  {
+    T s = sin(a.value()), c = cos(a.value());
+    return AutoDiff2<N,T>::chain(c, -s, -c, a);
+  }
+
+  template <size_t N, typename T>
+  auto exp (const AutoDiff2<N,T> & a)
+  {
+    T e = exp(a.value());
+    return AutoDiff2<N,T>::chain(e, e, e, a);
+  }
+
+  template <size_t N, typename T>
+  auto log (const AutoDiff2<N,T> & a)
+  {
+    T inv = T(1) / a.value();
+    return AutoDiff2<N,T>::chain(log(a.value()), inv, -inv*inv, a);
+  }
+
+  template <size_t N, typename T>
+  auto sqrt (const AutoDiff2<N,T> & a)
+  {
+    T s = sqrt(a.value());
+    T d1 = T(1) / (2*s);
+    return AutoDiff2<N,T>::chain(s, d1, -d1 / (2*a.value()), a);
+  }
+
+
+
+  // Truncated power series  a(t) = sum_k a_k t^k  up to degree P, the
+  // Taylor mode of AutoDiff. Only the degree deg() <= P is active, so one
+  // type serves all orders. Products and the elementary functions use the
+  // usual recurrences, O(deg^2) per operation.
+  template <size_t P, typename T = double>
+  class Taylor
+  {
+    size_t m_deg = 0;
+    std::array<T,P+1> m_coef;
+  public:
+    Taylor () : m_coef{} { }
+    Taylor (T v) : m_coef{} { m_coef[0] = v; }
+
+    static constexpr size_t maxDegree() { return P; }
+    size_t deg() const { return m_deg; }
+    void setDegree (size_t deg) { m_deg = deg; }
+    T value() const { return m_coef[0]; }
+    T & operator[] (size_t k) { return m_coef[k]; }
+    const T & operator[] (size_t k) const { return m_coef[k]; }
+  };
+
+  template <size_t P, typename T>
+  std::ostream & operator<< (std::ostream& os, const Taylor<P, T>& a)
+  {
+    os << "[";
+    for (size_t k = 0; k <= a.deg(); k++)
+      os << a[k] << (k < a.deg() ? ", " : "");
+    return os << "]";
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> operator+ (const Taylor<P,T> & a, const Taylor<P,T> & b)
+  {
+    Taylor<P,T> c;
+    c.setDegree(std::max(a.deg(), b.deg()));
+    for (size_t k = 0; k <= c.deg(); k++)
+      c[k] = a[k] + b[k];
+    return c;
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> operator- (const Taylor<P,T> & a, const Taylor<P,T> & b)
+  {
+    Taylor<P,T> c;
+    c.setDegree(std::max(a.deg(), b.deg()));
+    for (size_t k = 0; k <= c.deg(); k++)
+      c[k] = a[k] - b[k];
+    return c;
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> operator- (const Taylor<P,T> & a)
+  {
+    Taylor<P,T> c;
+    c.setDegree(a.deg());
+    for (size_t k = 0; k <= c.deg(); k++)
+      c[k] = -a[k];
+    return c;
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> operator* (const Taylor<P,T> & a, const Taylor<P,T> & b)
+  {
+    Taylor<P,T> c;
+    c.setDegree(std::max(a.deg(), b.deg()));
+    for (size_t k = 0; k <= c.deg(); k++)
+      {
+        T sum(0);
+        for (size_t j = (k > b.deg() ? k-b.deg() : 0); j <= std::min(k, a.deg()); j++)
+          sum += a[j] * b[k-j];
+        c[k] = sum;
+      }
+    return c;
+  }
+
+  // c = a/b:  c_k = (a_k - sum_{j=1}^k b_j c_{k-j}) / b_0
+  template <size_t P, typename T>
+  Taylor<P,T> operator/ (const Taylor<P,T> & a, const Taylor<P,T> & b)
+  {
+    Taylor<P,T> c;
+    c.setDegree(std::max(a.deg(), b.deg()));
+    T inv_b0 = T(1) / b[0];
+    for (size_t k = 0; k <= c.deg(); k++)
+      {
+        T sum = a[k];
+        for (size_t j = 1; j <= std::min(k, b.deg()); j++)
+          sum -= b[j] * c[k-j];
+        c[k] = sum * inv_b0;
+      }
+    return c;
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> operator+ (const Taylor<P,T> & a, std::type_identity_t<T> s)
+  {
+    Taylor<P,T> c(a);
+    c[0] += s;
+    return c;
+  }
+  template <size_t P, typename T>
+  Taylor<P,T> operator+ (std::type_identity_t<T> s, const Taylor<P,T> & a) { return a + s; }
+  template <size_t P, typename T>
+  Taylor<P,T> operator- (const Taylor<P,T> & a, std::type_identity_t<T> s) { return a + (-s); }
+  template <size_t P, typename T>
+  Taylor<P,T> operator- (std::type_identity_t<T> s, const Taylor<P,T> & a) { return (-a) + s; }
+
+  template <size_t P, typename T>
+  Taylor<P,T> operator* (const Taylor<P,T> & a, std::type_identity_t<T> s)
+  {
+    Taylor<P,T> c(a);
+    for (size_t k = 0; k <= c.deg(); k++)
+      c[k] *= s;
+    return c;
+  }
+  template <size_t P, typename T>
+  Taylor<P,T> operator* (std::type_identity_t<T> s, const Taylor<P,T> & a) { return a * s; }
+  template <size_t P, typename T>
+  Taylor<P,T> operator/ (const Taylor<P,T> & a, std::type_identity_t<T> s) { return a * (T(1)/s); }
+  template <size_t P, typename T>
+  Taylor<P,T> operator/ (std::type_identity_t<T> s, const Taylor<P,T> & a) { return Taylor<P,T>(s) / a; }
+
+  template <size_t P, typename T>
+  Taylor<P,T> & operator+= (Taylor<P,T> & a, const Taylor<P,T> & b) { return a = a + b; }
+  template <size_t P, typename T>
+  Taylor<P,T> & operator-= (Taylor<P,T> & a, const Taylor<P,T> & b) { return a = a - b; }
+
+  // s = sin a, c = cos a:  s_k = 1/k sum j a_j c_{k-j},  c_k = -1/k sum j a_j s_{k-j}
+  template <size_t P, typename T>
+  void SinCos (const Taylor<P,T> & a, Taylor<P,T> & s, Taylor<P,T> & c)
+  {
+    s.setDegree(a.deg());
+    c.setDegree(a.deg());
+    using std::sin, std::cos;
+    s[0] = sin(a[0]);
+    c[0] = cos(a[0]);
+    for (size_t k = 1; k <= a.deg(); k++)
+      {
+        T ss(0), cs(0);
+        for (size_t j = 1; j <= k; j++)
+          {
+            ss += T(j) * a[j] * c[k-j];
+            cs += T(j) * a[j] * s[k-j];
+          }
+        s[k] = ss / T(k);
+        c[k] = -cs / T(k);
+      }
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> sin (const Taylor<P,T> & a)
+  {
+    Taylor<P,T> s, c;
+    SinCos(a, s, c);
+    return s;
+  }
+
+  template <size_t P, typename T>
+  Taylor<P,T> cos (const Taylor<P,T> & a)
+  {
+    Taylor<P,T> s, c;
+    SinCos(a, s, c);
+    return c;
+  }
+
+  // c = exp a:  c_k = 1/k sum_{j=1}^k j a_j c_{k-j}
+  template <size_t P, typename T>
+  Taylor<P,T> exp (const Taylor<P,T> & a)
+  {
+    Taylor<P,T> c;
+    c.setDegree(a.deg());
+    using std::exp;
+    c[0] = exp(a[0]);
+    for (size_t k = 1; k <= a.deg(); k++)
+      {
+        T sum(0);
+        for (size_t j = 1; j <= k; j++)
+          sum += T(j) * a[j] * c[k-j];
+        c[k] = sum / T(k);
+      }
+    return c;
+  }
+
+  // c = log a:  c_k = (a_k - 1/k sum_{j=1}^{k-1} j c_j a_{k-j}) / a_0
+  template <size_t P, typename T>
+  Taylor<P,T> log (const Taylor<P,T> & a)
+  {
+    Taylor<P,T> c;
+    c.setDegree(a.deg());
+    using std::log;
+    c[0] = log(a[0]);
+    for (size_t k = 1; k <= a.deg(); k++)
+      {
+        T sum(0);
+        for (size_t j = 1; j < k; j++)
+          sum += T(j) * c[j] * a[k-j];
+        c[k] = (a[k] - sum / T(k)) / a[0];
+      }
+    return c;
+  }
+
+  // c = sqrt a:  c_k = (a_k - sum_{j=1}^{k-1} c_j c_{k-j}) / (2 c_0)
+  template <size_t P, typename T>
+  Taylor<P,T> sqrt (const Taylor<P,T> & a)
+  {
+    Taylor<P,T> c;
+    c.setDegree(a.deg());
+    using std::sqrt;
+    c[0] = sqrt(a[0]);
+    for (size_t k = 1; k <= a.deg(); k++)
+      {
+        T sum(0);
+        for (size_t j = 1; j < k; j++)
+          sum += c[j] * c[k-j];
+        c[k] = (a[k] - sum) / (2*c[0]);
+      }
+    return c;
+  }
+
+
+
+
+  // Reverse mode. Every operation on RevAD numbers appends a node with its
+  // (at most two) arguments and the partial derivatives to a Tape. One
+  // backward sweep from a scalar result gives the derivatives by all
+  // inputs, at a small multiple of the costs of one evaluation:
+  //
+  //   Tape tape;
+  //   std::vector<RevAD> x;
+  //   for (double xi : xvals) x.push_back(tape.variable(xi));
+  //   RevAD energy = Energy(x);
+  //   tape.gradient(energy);
+  //   ... tape.adjoint(x[i]) ...
+  //
+  // The nodes live in fixed size blocks which are kept by clear() and
+  // rewind(), a tape reused for the next evaluation does not allocate.
+  // A tape belongs to one thread.
+  class RevAD;
+
+  class Tape
+  {
+    struct Node
+    {
+      size_t a, b;      // arguments, a leaf refers to itself
+      double ca, cb;    // partial derivatives by a and b
+    };
+    static constexpr size_t block_bits = 12;
+    static constexpr size_t block_size = size_t(1) << block_bits;
+
+    std::vector<std::unique_ptr<Node[]>> m_blocks;
+    size_t m_size = 0, m_capacity = 0;
+    std::vector<double> m_adjoint;
+
+    Node & node (size_t i) { return m_blocks[i >> block_bits][i & (block_size-1)]; }
+    const Node & node (size_t i) const { return m_blocks[i >> block_bits][i & (block_size-1)]; }
+
+  public:
+    Tape () = default;
+    Tape (const Tape &) = delete;
+    Tape & operator= (const Tape &) = delete;
+
+    size_t size() const { return m_size; }
+
+    size_t push (size_t a, double ca, size_t b, double cb)
+    {
+      if (m_size == m_capacity)
+        {
+          m_blocks.push_back(std::make_unique<Node[]>(block_size));
+          m_capacity += block_size;
+        }
+      node(m_size) = { a, b, ca, cb };
+      return m_size++;
     }
 
+    // an independent variable
+    RevAD variable (double v);
 
+    // the tape position, nodes recorded later can be dropped by rewind,
+    // e.g. to evaluate another objective for the same inputs
+    size_t checkpoint () const { return m_size; }
+    void rewind (size_t pos) { m_size = std::min(m_size, pos); }
+    void clear () { m_size = 0; }
 
+    // backward sweep: adjoints of all nodes up to the result
+    void gradient (const RevAD & result);
 
+    double adjoint (size_t i) const { return i < m_adjoint.size() ? m_adjoint[i] : 0.0; }
+    double adjoint (const RevAD & v) const;
+  };
+
+
+  class RevAD
+  {
+    double m_val;
+    Tape * m_tape = nullptr;    // nullptr for constants
+    size_t m_index = 0;
+  public:
+    RevAD () : m_val(0) { }
+    RevAD (double v) : m_val(v) { }
+    RevAD (double v, Tape * tape, size_t index) : m_val(v), m_tape(tape), m_index(index) { }
+
+    double value() const { return m_val; }
+    Tape * tape() const { return m_tape; }
+    size_t index() const { return m_index; }
+
+    // node v = f(a), df/da = ca
+    static RevAD unary (double v, const RevAD & a, double ca)
+    {
+      if (!a.m_tape) return RevAD(v);
+      return RevAD(v, a.m_tape, a.m_tape->push(a.m_index, ca, a.m_index, 0.0));
+    }
+
+    // node v = f(a,b) with partials ca, cb, both on the same tape
+    static RevAD binary (double v, const RevAD & a, double ca, const RevAD & b, double cb)
+    {
+      if (!a.m_tape) return unary(v, b, cb);
+      if (!b.m_tape) return unary(v, a, ca);
+      assert(a.m_tape == b.m_tape && "RevAD: arguments on different tapes");
+      return RevAD(v, a.m_tape, a.m_tape->push(a.m_index, ca, b.m_index, cb));
+    }
+  };
+
+  inline RevAD Tape::variable (double v)
+  {
+    size_t i = m_size;
+    return RevAD(v, this, push(i, 0.0, i, 0.0));
+  }
+
+  inline void Tape::gradient (const RevAD & result)
+  {
+    m_adjoint.assign(m_size, 0.0);
+    if (result.tape() != this) return;
+    if (result.index() >= m_size)
+      throw std::out_of_range("Tape::gradient: result was recorded before a rewind");
+    m_adjoint[result.index()] = 1.0;
+    double * adjoint = m_adjoint.data();
+    for (size_t blk = result.index() >> block_bits; blk+1 > 0; blk--)
+      {
+        const Node * nodes = m_blocks[blk].get();
+        size_t first = blk << block_bits;
+        for (size_t i = std::min(result.index()+1, first+block_size); i-- > first; )
+          {
+            const Node & n = nodes[i-first];
+            double adj = adjoint[i];
+            adjoint[n.a] += n.ca * adj;
+            adjoint[n.b] += n.cb * adj;
+          }
+      }
+  }
+
+  inline double Tape::adjoint (const RevAD & v) const
+  {
+    return v.tape() == this ? adjoint(v.index()) : 0.0;
+  }
+
+
+  inline std::ostream & operator<< (std::ostream& os, const RevAD & ad)
+  {
+    return os << ad.value();
+  }
+
+  inline RevAD operator+ (const RevAD & a, const RevAD & b)
+  { return RevAD::binary(a.value()+b.value(), a, 1.0, b, 1.0); }
+  inline RevAD operator- (const RevAD & a, const RevAD & b)
+  { return RevAD::binary(a.value()-b.value(), a, 1.0, b, -1.0); }
+  inline RevAD operator* (const RevAD & a, const RevAD & b)
+  { return RevAD::binary(a.value()*b.value(), a, b.value(), b, a.value()); }
+  inline RevAD operator/ (const RevAD & a, const RevAD & b)
+  {
+    double inv_b = 1.0 / b.value();
+    return RevAD::binary(a.value()/b.value(), a, inv_b, b, -a.value()*inv_b*inv_b);
+  }
+  inline RevAD operator- (const RevAD & a) { return RevAD::unary(-a.value(), a, -1.0); }
+
+  inline RevAD operator+ (const RevAD & a, double s) { return RevAD::unary(a.value()+s, a, 1.0); }
+  inline RevAD operator+ (double s, const RevAD & a) { return a + s; }
+  inline RevAD operator- (const RevAD & a, double s) { return RevAD::unary(a.value()-s, a, 1.0); }
+  inline RevAD operator- (double s, const RevAD & a) { return RevAD::unary(s-a.value(), a, -1.0); }
+  inline RevAD operator* (const RevAD & a, double s) { return RevAD::unary(a.value()*s, a, s); }
+  inline RevAD operator* (double s, const RevAD & a) { return a * s; }
+  inline RevAD operator/ (const RevAD & a, double s) { return RevAD::unary(a.value()/s, a, 1.0/s); }
+  inline RevAD operator/ (double s, const RevAD & a)
+  { return RevAD::unary(s/a.value(), a, -s/(a.value()*a.value())); }
+
+  inline RevAD & operator+= (RevAD & a, const RevAD & b) { return a = a + b; }
+  inline RevAD & operator-= (RevAD & a, const RevAD & b) { return a = a - b; }
+
+  inline RevAD sin (const RevAD & a) { return RevAD::unary(std::sin(a.value()), a, std::cos(a.value())); }
+  inline RevAD cos (const RevAD & a) { return RevAD::unary(std::cos(a.value()), a, -std::sin(a.value())); }
+  inline RevAD exp (const RevAD & a)
+  {
+    double val = std::exp(a.value());
+    return RevAD::unary(val, a, val);
+  }
+  inline RevAD log (const RevAD & a) { return RevAD::unary(std::log(a.value()), a, 1.0/a.value()); }
+  inline RevAD sqrt (const RevAD & a)
+  {
+    double val = std::sqrt(a.value());
+    return RevAD::unary(val, a, 0.5/val);
+  }
 
 
 } // namespace ASC_ode
@@ -0,0 +1,133 @@
+#ifndef BANDMATRIX_HPP
+#define BANDMATRIX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <vector.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // n x n matrix with entries only for |i-j| <= bw.
+  // Row i stores the columns [i-bw, i+2bw], the extra bw entries right of
+  // the band take the fill-in of the LU factorization with row pivoting.
+  // factor + solve cost O(n bw^2) instead of O(n^3).
+  class BandMatrix
+  {
+    size_t m_n, m_bw, m_width;
+    std::vector<double> m_data;
+    std::vector<size_t> m_pivot;
+  public:
+    BandMatrix (size_t n, size_t bw)
+      : m_n(n), m_bw(bw), m_width(3*bw+1), m_data(n*(3*bw+1), 0.0) { }
+
+    size_t size() const { return m_n; }
+    size_t bandwidth() const { return m_bw; }
+
+    bool inBand (size_t i, size_t j) const
+    { return (i > j ? i-j : j-i) <= m_bw && i < m_n && j < m_n; }
+
+    double & operator() (size_t i, size_t j) { return m_data[i*m_width + j+m_bw-i]; }
+    double operator() (size_t i, size_t j) const { return m_data[i*m_width + j+m_bw-i]; }
+
+    void setZero () { std::fill(m_data.begin(), m_data.end(), 0.0); }
+
+    BandMatrix & operator*= (double s)
+    {
+      for (auto & v : m_data) v *= s;
+      return *this;
+    }
+
+    // this += s * b, b of the same size and bandwidth
+    void add (double s, const BandMatrix & b)
+    {
+      for (size_t k = 0; k < m_data.size(); k++)
+        m_data[k] += s * b.m_data[k];
+    }
+
+    void scaleRows (VectorView<double> d)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t k = 0; k < m_width; k++)
+          m_data[i*m_width+k] *= d(i);
+    }
+
+    void scaleCols (VectorView<double> d)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t j = (i > m_bw ? i-m_bw : 0); j <= std::min(m_n-1, i+m_bw); j++)
+          (*this)(i,j) *= d(j);
+    }
+
+    // y = A x, only before factor
+    void mult (VectorView<double> x, VectorView<double> y) const
+    {
+      for (size_t i = 0; i < m_n; i++)
+        {
+          double sum = 0;
+          for (size_t j = (i > m_bw ? i-m_bw : 0); j <= std::min(m_n-1, i+m_bw); j++)
+            sum += (*this)(i,j) * x(j);
+          y(i) = sum;
+        }
+    }
+
+    // in place LU with partial pivoting (as LAPACK dgbtrf)
+    void factor ()
+    {
+      size_t bw = m_bw;
+      m_pivot.resize(m_n);
+      for (size_t k = 0; k < m_n; k++)
+        {
+          size_t last = std::min(m_n-1, k+bw);
+          size_t p = k;
+          for (size_t i = k+1; i <= last; i++)
+            if (std::abs((*this)(i,k)) > std::abs((*this)(p,k)))
+              p = i;
+          m_pivot[k] = p;
+          if ((*this)(p,k) == 0)
+            throw std::domain_error("BandMatrix::factor: matrix is singular");
+
+          size_t lastcol = std::min(m_n-1, k+2*bw);
+          if (p != k)
+            for (size_t j = k; j <= lastcol; j++)
+              std::swap((*this)(k,j), (*this)(p,j));
+
+          double invpivot = 1.0 / (*this)(k,k);
+          for (size_t i = k+1; i <= last; i++)
+            {
+              double l = (*this)(i,k) *= invpivot;
+              if (l == 0) continue;
+              for (size_t j = k+1; j <= lastcol; j++)
+                (*this)(i,j) -= l * (*this)(k,j);
+            }
+        }
+    }
+
+    // solves A x = b with the factors, b is overwritten by x
+    void solve (VectorView<double> b) const
+    {
+      size_t bw = m_bw;
+      for (size_t k = 0; k < m_n; k++)
+        {
+          std::swap(b(k), b(m_pivot[k]));
+          for (size_t i = k+1; i <= std::min(m_n-1, k+bw); i++)
+            b(i) -= (*this)(i,k) * b(k);
+        }
+      for (size_t i = m_n; i-- > 0; )
+        {
+          double sum = b(i);
+          for (size_t j = i+1; j <= std::min(m_n-1, i+2*bw); j++)
+            sum -= (*this)(i,j) * b(j);
+          b(i) = sum / (*this)(i,i);
+        }
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef ENERGYFUNCTION_HPP
+#define ENERGYFUNCTION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#include "autodiff.hpp"
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  // unused local unknown of an element
+  constexpr size_t NO_DOF = size_t(-1);
+
+  // f = -grad E and df = -Hessian E of a potential energy which is a sum of
+  // element energies, each depending on at most NL unknowns. F provides
+  //
+  //   size_t dimX() const
+  //   size_t numElements() const
+  //   // global numbers of the local unknowns, NO_DOF for unused ones
+  //   std::array<size_t,NL> elementDofs (size_t el) const
+  //   template <typename T> T T_energy (size_t el, const std::array<T,NL> & x) const
+  //
+  // The forces come from AutoDiff<NL>, the stiffness from AutoDiff2<NL>,
+  // both exact. A global energy is one element with all unknowns.
+  template <typename F, size_t NL>
+  class EnergyFunction : public NonlinearFunction
+  {
+    std::shared_ptr<F> m_func;
+  public:
+    EnergyFunction (std::shared_ptr<F> func) : m_func(func) { }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimX(); }
+
+    double energy (VectorView<double> x) const
+    {
+      double e = 0;
+      for (size_t el = 0; el < m_func->numElements(); el++)
+        {
+          auto dofs = m_func->elementDofs(el);
+          std::array<double,NL> xl;
+          for (size_t a = 0; a < NL; a++)
+            xl[a] = dofs[a] != NO_DOF ? x(dofs[a]) : 0.0;
+          e += m_func->template T_energy<double>(el, xl);
+        }
+      return e;
+    }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      f = 0.0;
+      for (size_t el = 0; el < m_func->numElements(); el++)
+        {
+          auto dofs = m_func->elementDofs(el);
+          std::array<AutoDiff<NL>,NL> xl;
+          for (size_t a = 0; a < NL; a++)
+            if (dofs[a] != NO_DOF)
+              {
+                xl[a] = AutoDiff<NL>(x(dofs[a]));
+                xl[a].deriv()[a] = 1.0;
+              }
+          AutoDiff<NL> e = m_func->template T_energy<AutoDiff<NL>>(el, xl);
+          for (size_t a = 0; a < NL; a++)
+            if (dofs[a] != NO_DOF)
+              f(dofs[a]) -= e.deriv()[a];
+        }
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      assembleHessian(x, [&] (size_t i, size_t j, double h) { df(i,j) -= h; });
+    }
+
+    // the widest coupling of two unknowns of one element
+    size_t bandwidth() const override
+    {
+      size_t bw = 0;
+      for (size_t el = 0; el < m_func->numElements(); el++)
+        {
+          auto dofs = m_func->elementDofs(el);
+          for (size_t a = 0; a < NL; a++)
+            for (size_t b = 0; b < a; b++)
+              if (dofs[a] != NO_DOF && dofs[b] != NO_DOF)
+                bw = std::max(bw, dofs[a] > dofs[b] ? dofs[a]-dofs[b] : dofs[b]-dofs[a]);
+        }
+      return bw;
+    }
+
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      df.setZero();
+      bool inband = true;
+      assembleHessian(x, [&] (size_t i, size_t j, double h)
+      {
+        if (df.inBand(i,j))
+          df(i,j) -= h;
+        else
+          inband = false;
+      });
+      return inband;
+    }
+
+  private:
+    // calls add(i, j, d^2E/dx_i dx_j) element by element
+    template <typename ADD>
+    void assembleHessian (VectorView<double> x, ADD add) const
+    {
+      for (size_t el = 0; el < m_func->numElements(); el++)
+        {
+          auto dofs = m_func->elementDofs(el);
+          std::array<AutoDiff2<NL>,NL> xl;
+          for (size_t a = 0; a < NL; a++)
+            if (dofs[a] != NO_DOF)
+              {
+                xl[a] = AutoDiff2<NL>(x(dofs[a]));
+                xl[a].grad()[a] = 1.0;
+              }
+          AutoDiff2<NL> e = m_func->template T_energy<AutoDiff2<NL>>(el, xl);
+          for (size_t a = 0; a < NL; a++)
+            for (size_t b = 0; b < NL; b++)
+              if (dofs[a] != NO_DOF && dofs[b] != NO_DOF)
+                add(dofs[a], dofs[b], e.hessian(a, b));
+        }
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "taskmanager.hpp"
+
+namespace ASC_ode
+{
+
+  // Cartesian product of parameter axes. Run r is decoded mixed radix,
+  // the last axis varies fastest.
+  class ParameterGrid
+  {
+    std::vector<std::string> m_names;
+    std::vector<std::vector<double>> m_values;
+  public:
+    ParameterGrid & add (std::string name, std::vector<double> values)
+    {
+      if (values.empty())
+        throw std::invalid_argument("ParameterGrid: axis " + name + " has no values");
+      m_names.push_back(std::move(name));
+      m_values.push_back(std::move(values));
+      return *this;
+    }
+
+    // n equidistant values from a to b
+    static std::vector<double> linspace (double a, double b, size_t n)
+    {
+      std::vector<double> values(n);
+      for (size_t i = 0; i < n; i++)
+        values[i] = (n > 1) ? a + (b-a)*i/(n-1) : a;
+      return values;
+    }
+
+    size_t numParameters() const { return m_names.size(); }
+    const std::string & name (size_t i) const { return m_names[i]; }
+
+    size_t size() const
+    {
+      size_t n = 1;
+      for (auto & v : m_values) n *= v.size();
+      return n;
+    }
+
+    std::vector<double> point (size_t run) const
+    {
+      std::vector<double> p(m_names.size());
+      for (size_t i = m_names.size(); i-- > 0; )
+        {
+          p[i] = m_values[i][run % m_values[i].size()];
+          run /= m_values[i].size();
+        }
+      return p;
+    }
+  };
+
+
+  // Runs  result[r] = simulate(grid.point(r), workspace)  for all grid points
+  // on the work-stealing pool. Every thread has its own Workspace
+  // (default constructed, reused by all runs of that thread): simulate
+  // can keep its system, solver functions and vectors there, set up at
+  // the first run and only re-parametrized by the later ones (see
+  // exercise20_chain_ensemble.cpp). Results are in grid order.
+  template <typename Workspace, typename Result, typename F>
+  std::vector<Result> RunEnsemble (const ParameterGrid & grid, F simulate)
+  {
+    auto & tm = TaskManager::instance();
+    std::vector<Workspace> workspaces(tm.numThreads());
+    std::vector<Result> results(grid.size());
+
+    tm.runStealing(grid.size(), [&] (size_t run, size_t thread)
+    {
+      results[run] = simulate(grid.point(run), workspaces[thread]);
+    });
+    return results;
+  }
+
+  // without workspace:  simulate(params) -> Result
+  template <typename Result, typename F>
+  std::vector<Result> RunEnsemble (const ParameterGrid & grid, F simulate)
+  {
+    struct NoWorkspace { };
+    return RunEnsemble<NoWorkspace, Result>
+      (grid, [&] (const std::vector<double> & p, NoWorkspace &) { return simulate(p); });
+  }
+
+
+  // One tab-separated table: the parameters of each run followed by its
+  // values (summary statistics or a flattened trajectory).
+  inline void WriteEnsemble (std::ostream & ost, const ParameterGrid & grid,
+                             const std::vector<std::string> & columns,
+                             const std::vector<std::vector<double>> & results)
+  {
+    ost << "run";
+    for (size_t i = 0; i < grid.numParameters(); i++)
+      ost << "\t" << grid.name(i);
+    for (auto & c : columns)
+      ost << "\t" << c;
+    ost << "\n";
+
+    for (size_t r = 0; r < results.size(); r++)
+      {
+        ost << r;
+        for (double p : grid.point(r))
+          ost << "\t" << p;
+        for (double v : results[r])
+          ost << "\t" << v;
+        ost << "\n";
+      }
+  }
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+#include <taylorstepper.hpp>
+#include "pendulum_ad.hpp"
+
+using namespace ASC_ode;
+using namespace std;
+
+// Pendulum on [0,20]: the Taylor stepper (order and step size from the
+// tolerance) against Gauss-Legendre with 3 stages (order 6). The
+// reference is the Taylor stepper at tolerance 1e-16 with 2000 outer steps.
+
+double Energy(VectorView<double> y)
+{
+  return 0.5 * y(1) * y(1) - 9.81 * cos(y(0));
+}
+
+double Error(VectorView<double> y, VectorView<double> yref)
+{
+  return max(abs(y(0) - yref(0)), abs(y(1) - yref(1)));
+}
+
+int main(int argc, char *argv[])
+{
+  string output_dir = ".";
+  if (argc > 1) output_dir = argv[1];
+
+  auto pend = make_shared<PendulumAD>(1.0);
+  double tend = 20;
+  Vector<> y0 = {1.0, 0.0};
+
+  Vector<> yref(y0);
+  TaylorStepper<PendulumAD> reference(pend, 1e-16);
+  for (int i = 0; i < 2000; i++)
+    reference.DoStep(tend / 2000, yref);
+
+  std::ofstream outfile(output_dir + "/taylor.tsv");
+  outfile << "method" << "\t" << "tol" << "\t" << "order" << "\t" << "steps"
+          << "\t" << "error" << "\t" << "energy_error" << std::endl;
+
+  for (double tol : {1e-8, 1e-12, 1e-14})
+  {
+    Vector<> y(y0);
+    TaylorStepper<PendulumAD> stepper(pend, tol);
+    stepper.DoStep(tend, y);
+    outfile << "taylor" << "\t" << tol << "\t" << stepper.order() << "\t" << stepper.numSubsteps()
+            << "\t" << Error(y, yref) << "\t" << Energy(y) - Energy(y0) << std::endl;
+  }
+
+  Vector<> c(3), w(3);
+  GaussLegendre(c, w);
+  auto [A, b] = ComputeABfromC(c);
+  for (int steps : {200, 1000, 4000})
+  {
+    Vector<> y(y0);
+    ImplicitRungeKutta stepper(pend, A, b, c);
+    for (int i = 0; i < steps; i++)
+      stepper.DoStep(tend / steps, y);
+    outfile << "gauss3" << "\t" << "-" << "\t" << 6 << "\t" << steps
+            << "\t" << Error(y, yref) << "\t" << Energy(y) - Energy(y0) << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <mass_spring.hpp>
+#include <Newmark.hpp>
+#include <ensemble.hpp>
+
+using namespace ASC_ode;
+using namespace std;
+
+constexpr int D = 2; // Dimensionality (2D)
+
+// ------------------ The chain of exercise20_chain.cpp with its solver
+// functions and state vectors, set up once per thread
+struct ChainSolver
+{
+    MassSpringSystem<D> mss;
+    Vector<> state, v, a;
+    shared_ptr<MSS_Function<D>> rhs;
+    shared_ptr<IdentityFunction> mass_matrix;
+
+    ChainSolver() : state(3*D), v(3*D), a(3*D)
+    {
+        mss.setGravity({0.0, -9.81});
+
+        auto fix = mss.addFix({ {0.0, 0.0} });
+        auto m1 = mss.addMass({ 1.0, {1.0, 0.0}, {0.0, 0.0}, {0.0, 0.0} });
+        auto m2 = mss.addMass({ 1.0, {2.0, 0.0}, {0.0, 0.0}, {0.0, 0.0} });
+        auto m3 = mss.addMass({ 1.0, {3.0, 0.0}, {0.0, 0.0}, {0.0, 0.0} });
+
+        mss.addSpring({ 1.0, 1.0, {fix, m1} });
+        mss.addSpring({ 1.0, 1.0, {m1, m2} });
+        mss.addSpring({ 1.0, 1.0, {m2, m3} });
+
+        rhs = std::make_shared<MSS_Function<D>>(mss);
+        mass_matrix = std::make_shared<IdentityFunction>(rhs->dimX());
+    }
+};
+
+// per-thread solver workspace, reused by all runs of a thread: the
+// topology stays, a run only sets the parameters and the initial state
+struct ChainWorkspace
+{
+    unique_ptr<ChainSolver> solver;
+    vector<double> tip_y;
+};
+
+// ------------------ One parameter set
+vector<double> SimulateChain(double k, double m, double disp, double dt, ChainWorkspace & ws)
+{
+    if (!ws.solver) ws.solver = make_unique<ChainSolver>();
+    auto & s = *ws.solver;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        s.mss.setSpringStiffness(i, k);
+        s.mss.masses()[i].mass = m;   // parameters only, no recompile
+    }
+    s.mss.getState(s.state, s.v, s.a);
+    s.state(4) = disp; s.state(5) = -1.0;
+
+    ws.tip_y.clear();
+    double max_stretch = 0;
+    auto callback = [&](double t, VectorView<double> x) {
+        ws.tip_y.push_back(x(5));
+        double prev_x = 0, prev_y = 0;
+        for (int i = 0; i < 3; i++) {
+            double len = hypot(x(2*i)-prev_x, x(2*i+1)-prev_y);
+            max_stretch = max(max_stretch, len - 1.0);
+            prev_x = x(2*i); prev_y = x(2*i+1);
+        }
+    };
+
+    SolveODE_Alpha(10.0, int(10.0/dt), 0.8, s.state, s.v, s.a, s.rhs, s.mass_matrix, callback);
+
+    double mean = 0;
+    for (double y : ws.tip_y) mean += y;
+    mean /= ws.tip_y.size();
+    auto [ymin, ymax] = minmax_element(ws.tip_y.begin(), ws.tip_y.end());
+    return { *ymin, *ymax, mean, max_stretch, s.state(4), s.state(5) };
+}
+
+// ------------------ Main procedure
+// Sweep over stiffness, mass and initial displacement of the last mass,
+// all runs in one process on all cores (threads: ASC_NUM_THREADS)
+int main(int argc, char *argv[])
+{
+    string output_dir = ".";
+    if (argc > 1) output_dir = argv[1];
+
+    ParameterGrid grid;
+    grid.add("k", ParameterGrid::linspace(200.0, 2000.0, 10))
+        .add("m", ParameterGrid::linspace(0.5, 2.0, 4))
+        .add("disp", ParameterGrid::linspace(2.0, 3.0, 5));
+
+    cout << "Simulating " << grid.size() << " chains on "
+         << TaskManager::instance().numThreads() << " threads" << endl;
+
+    auto results = RunEnsemble<ChainWorkspace, vector<double>>
+        (grid, [](const vector<double> & p, ChainWorkspace & ws) {
+            return SimulateChain(p[0], p[1], p[2], 0.01, ws);
+        });
+
+    std::ofstream outfile(output_dir + "/chain_ensemble.tsv");
+    WriteEnsemble(outfile, grid,
+                  { "tip_y_min", "tip_y_max", "tip_y_mean", "max_stretch", "tip_x_end", "tip_y_end" },
+                  results);
+    return 0;
+}
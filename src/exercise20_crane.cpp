@@ -12,79 +12,6 @@ using namespace std;
 
 constexpr int D = 2; // Dimensionality (2D)
 
-class ExactMSSFunction : public MSS_Function<D>
-{
-private:
-  MassSpringSystem<D> & mss_ref; 
-
-public:
-  ExactMSSFunction(MassSpringSystem<D> & _mss) 
-    : MSS_Function<D>(_mss), mss_ref(_mss) { }
-
-  virtual void evaluateDeriv(VectorView<double> x, MatrixView<double> df) const override
-  {
-    // Checking dimensions
-    size_t n_masses = mss_ref.masses().size();
-    df = 0.0;
-    auto xmat = x.asMatrix(n_masses, D);
-
-    for (const auto& spring : mss_ref.springs())
-    {
-      auto [c1, c2] = spring.connectors;
-            
-      if (c1.type == Connector::FIX && c2.type == Connector::FIX) continue;
-
-        // Getting positions
-        Vec<D> p1 = (c1.type == Connector::FIX) ? mss_ref.fixes()[c1.nr].pos : xmat.row(c1.nr);
-        Vec<D> p2 = (c2.type == Connector::FIX) ? mss_ref.fixes()[c2.nr].pos : xmat.row(c2.nr);
-
-        Vec<D> d = p2 - p1;
-        double r = norm(d);
-        if (r < 1e-12) continue;
-
-        Vec<D> u = (1.0 / r) * d;
-
-        double k = spring.stiffness;
-        double l0 = spring.length;
-
-        double alpha = k * (1.0 - l0 / r); 
-        double beta  = k * (l0 / r);      
-
-        double K_local[D][D];
-        for (int i = 0; i < D; i++)
-          for (int j = 0; j < D; j++)
-            K_local[i][j] = (i == j ? alpha : 0.0) + beta * u(i) * u(j);
-
-        // Filling the global matrix
-        if (c1.type == Connector::MASS)
-        {
-          double invm1 = 1.0 / mss_ref.masses()[c1.nr].mass;
-          size_t idx1 = c1.nr;
-                
-          for (int i=0; i<D; i++) for (int j=0; j<D; j++) {
-            df(idx1*D + i, idx1*D + j) -= invm1 * K_local[i][j];
-                    
-            if (c2.type == Connector::MASS)
-              df(idx1*D + i, c2.nr*D + j) += invm1 * K_local[i][j];
-            }
-        }
-
-        if (c2.type == Connector::MASS)
-        {
-          double invm2 = 1.0 / mss_ref.masses()[c2.nr].mass;
-          size_t idx2 = c2.nr;
-
-          for (int i=0; i<D; i++) for (int j=0; j<D; j++) {
-            df(idx2*D + i, idx2*D + j) -= invm2 * K_local[i][j];
-
-            if (c1.type == Connector::MASS)
-              df(idx2*D + i, c1.nr*D + j) += invm2 * K_local[i][j];
-            }
-        }
-    }
-  }
-};
-
 // ------------------ Function for running a simulation
 void RunSimulation(string filename, double dt)
 {
@@ -153,7 +80,7 @@ void RunSimulation(string filename, double dt)
   mss.setState(state, v, a);
 
   // Solver Setup
-  auto rhs = std::make_shared<ExactMSSFunction>(mss);
+  auto rhs = std::make_shared<MSS_Function<D>>(mss);
   auto mass_matrix = std::make_shared<IdentityFunction>(rhs->dimX());
 
   std::ofstream outfile(filename);
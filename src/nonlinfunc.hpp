@@ -1,11 +1,16 @@
 #ifndef NONLINFUNC_H
 #define NONLINFUNC_H
 
+#include <algorithm>
 #include <cstddef>
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include <vector.hpp>
 #include <matrix.hpp>
+#include <bandmatrix.hpp>
+#include <skylinematrix.hpp>
 
 namespace ASC_ode
 {
@@ -19,9 +24,59 @@ namespace ASC_ode
     virtual size_t dimF() const = 0;
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const = 0;
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const = 0;
+
+    // if the Jacobian is diagonal, store its diagonal in d and return true.
+    // Lets compositions scale instead of forming dense matrix products.
+    virtual bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const { return false; }
+
+    // The Jacobian has entries only for |i-j| <= bandwidth(). A function
+    // returning less than dimX() must implement evaluateBandDeriv, which
+    // fills the band of df (df.bandwidth() >= bandwidth()).
+    virtual size_t bandwidth() const { return dimX(); }
+    virtual bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const { return false; }
+
+    // The Jacobian has entries only inside this skyline profile (first
+    // column of every row, see SkylineMatrix), empty if there is none.
+    // Diagonal Jacobians have the trivial profile. A function returning a
+    // profile implements evaluateSkylineDeriv, which fills df (the profile
+    // of df contains skylineProfile()).
+    virtual std::vector<size_t> skylineProfile() const
+    {
+      if (bandwidth() != 0 || dimF() != dimX()) return { };
+      std::vector<size_t> firstcol(dimX());
+      for (size_t i = 0; i < firstcol.size(); i++)
+        firstcol[i] = i;
+      return firstcol;
+    }
+    virtual bool evaluateSkylineDeriv (VectorView<double> x, SkylineMatrix & df) const
+    {
+      Vector<> d(dimF());
+      if (bandwidth() != 0 || !evaluateDiagDeriv(x, d)) return false;
+      df.setZero();
+      for (size_t i = 0; i < d.size(); i++)
+        df(i,i) = d(i);
+      return true;
+    }
   };
 
 
+  // dfdp = df/dp (dimF x P) at x, the derivatives of a function by its
+  // P parameters, for the sensitivities of the time steppers
+  using ParameterDerivative = std::function<void(VectorView<double> x, MatrixView<double> dfdp)>;
+
+
+  // band Jacobian of a function with diagonal Jacobian
+  inline bool DiagToBand (const NonlinearFunction & func, VectorView<double> x, BandMatrix & df)
+  {
+    Vector<> d(func.dimF());
+    if (!func.evaluateDiagDeriv(x, d)) return false;
+    df.setZero();
+    for (size_t i = 0; i < d.size(); i++)
+      df(i,i) = d(i);
+    return true;
+  }
+
+
   class IdentityFunction : public NonlinearFunction
   {
     size_t m_n;
@@ -39,6 +94,71 @@ namespace ASC_ode
       df = 0.0;
       df.diag() = 1.0;
     }
+
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = 1.0;
+      return true;
+    }
+    size_t bandwidth() const override { return 0; }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      return DiagToBand(*this, x, df);
+    }
+  };
+
+
+  // f = diag(d) x, e.g. a diagonal (or singular, for DAEs) mass matrix
+  class DiagonalFunction : public NonlinearFunction
+  {
+    Vector<> m_diag;
+  public:
+    DiagonalFunction (VectorView<double> diag) : m_diag(diag) { }
+    VectorView<double> get() const { return m_diag; }
+    size_t dimX() const override { return m_diag.size(); }
+    size_t dimF() const override { return m_diag.size(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      for (size_t i = 0; i < m_diag.size(); i++)
+        f(i) = m_diag(i)*x(i);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      df.diag() = m_diag;
+    }
+
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = m_diag;
+      return true;
+    }
+    size_t bandwidth() const override { return 0; }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      return DiagToBand(*this, x, df);
+    }
+  };
+
+
+  // row-sum lumping of a consistent mass matrix
+  class LumpedMassFunction : public DiagonalFunction
+  {
+    static Vector<> RowSums (MatrixView<double> mass)
+    {
+      Vector<> sums(mass.rows());
+      for (size_t i = 0; i < mass.rows(); i++)
+        {
+          sums(i) = 0;
+          for (size_t j = 0; j < mass.cols(); j++)
+            sums(i) += mass(i,j);
+        }
+      return sums;
+    }
+  public:
+    LumpedMassFunction (MatrixView<double> mass)
+      : DiagonalFunction(RowSums(mass)) { }
   };
 
 
@@ -61,6 +181,16 @@ namespace ASC_ode
     {
       df = 0.0;
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = 0.0;
+      return true;
+    }
+    size_t bandwidth() const override { return 0; }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      return DiagToBand(*this, x, df);
+    }
   };
 
 
@@ -93,6 +223,45 @@ namespace ASC_ode
       m_fb->evaluateDeriv(x, tmp);
       df += m_facb*tmp;
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      Vector<> tmp(dimF());
+      if (!m_fa->evaluateDiagDeriv(x, d) || !m_fb->evaluateDiagDeriv(x, tmp))
+        return false;
+      d *= m_faca;
+      d += m_facb*tmp;
+      return true;
+    }
+    size_t bandwidth() const override
+    {
+      return std::max(m_fa->bandwidth(), m_fb->bandwidth());
+    }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      BandMatrix tmp(df.size(), df.bandwidth());
+      if (!m_fa->evaluateBandDeriv(x, df) || !m_fb->evaluateBandDeriv(x, tmp))
+        return false;
+      df *= m_faca;
+      df.add(m_facb, tmp);
+      return true;
+    }
+    std::vector<size_t> skylineProfile() const override
+    {
+      auto pa = m_fa->skylineProfile(), pb = m_fb->skylineProfile();
+      if (pa.empty() || pb.empty()) return { };
+      for (size_t i = 0; i < pa.size(); i++)
+        pa[i] = std::min(pa[i], pb[i]);
+      return pa;
+    }
+    bool evaluateSkylineDeriv (VectorView<double> x, SkylineMatrix & df) const override
+    {
+      SkylineMatrix tmp(df.profile());
+      if (!m_fa->evaluateSkylineDeriv(x, df) || !m_fb->evaluateSkylineDeriv(x, tmp))
+        return false;
+      df *= m_faca;
+      df.add(m_facb, tmp);
+      return true;
+    }
   };
 
 
@@ -137,6 +306,27 @@ namespace ASC_ode
       m_fa->evaluateDeriv(x, df);
       df *= m_fac->get();
     }
+
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      if (!m_fa->evaluateDiagDeriv(x, d)) return false;
+      d *= m_fac->get();
+      return true;
+    }
+    size_t bandwidth() const override { return m_fa->bandwidth(); }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      if (!m_fa->evaluateBandDeriv(x, df)) return false;
+      df *= m_fac->get();
+      return true;
+    }
+    std::vector<size_t> skylineProfile() const override { return m_fa->skylineProfile(); }
+    bool evaluateSkylineDeriv (VectorView<double> x, SkylineMatrix & df) const override
+    {
+      if (!m_fa->evaluateSkylineDeriv(x, df)) return false;
+      df *= m_fac->get();
+      return true;
+    }
   };
 
   inline auto operator* (std::shared_ptr<Parameter> parama,
@@ -175,6 +365,32 @@ namespace ASC_ode
       Vector<> tmp(m_fb->dimF());
       m_fb->evaluate (x, tmp);
 
+      // a diagonal factor is applied as row or column scaling,
+      // no dense product needed
+      Vector<> diag(m_fb->dimF());
+      if (m_fa->evaluateDiagDeriv(tmp, diag))
+        {
+          m_fb->evaluateDeriv(x, df);
+          for (size_t i = 0; i < df.rows(); i++)
+            df.row(i) *= diag(i);
+          return;
+        }
+      if (m_fb->evaluateDiagDeriv(x, diag))
+        {
+          bool zero = true;
+          for (size_t j = 0; j < diag.size(); j++)
+            if (diag(j) != 0) zero = false;
+          if (zero)  // constant inner function, e.g. the old state
+            {
+              df = 0.0;
+              return;
+            }
+          m_fa->evaluateDeriv(tmp, df);
+          for (size_t j = 0; j < df.cols(); j++)
+            df.col(j) *= diag(j);
+          return;
+        }
+
       Matrix<double> jaca(m_fa->dimF(), m_fa->dimX());
       Matrix<double> jacb(m_fb->dimF(), m_fb->dimX());
 
@@ -183,6 +399,89 @@ namespace ASC_ode
 
       df = jaca*jacb;
     }
+
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      Vector<> tmp(m_fb->dimF());
+      Vector<> diaga(m_fb->dimF());
+      m_fb->evaluate (x, tmp);
+      if (!m_fb->evaluateDiagDeriv(x, d) || !m_fa->evaluateDiagDeriv(tmp, diaga))
+        return false;
+      for (size_t i = 0; i < d.size(); i++)
+        d(i) *= diaga(i);
+      return true;
+    }
+
+    // banded if one of the factors is diagonal
+    size_t bandwidth() const override
+    {
+      size_t bwa = m_fa->bandwidth(), bwb = m_fb->bandwidth();
+      if (bwa == 0 || bwb == 0)
+        return std::max(bwa, bwb);
+      return dimX();
+    }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      Vector<> tmp(m_fb->dimF());
+      Vector<> diag(m_fb->dimF());
+      m_fb->evaluate (x, tmp);
+      if (m_fa->bandwidth() == 0 && m_fa->evaluateDiagDeriv(tmp, diag))
+        {
+          if (!m_fb->evaluateBandDeriv(x, df)) return false;
+          df.scaleRows(diag);
+          return true;
+        }
+      if (m_fb->bandwidth() == 0 && m_fb->evaluateDiagDeriv(x, diag))
+        {
+          bool zero = true;
+          for (size_t j = 0; j < diag.size(); j++)
+            if (diag(j) != 0) zero = false;
+          if (zero)
+            {
+              df.setZero();
+              return true;
+            }
+          if (!m_fa->evaluateBandDeriv(tmp, df)) return false;
+          df.scaleCols(diag);
+          return true;
+        }
+      return false;
+    }
+
+    // the profile of the non-diagonal factor
+    std::vector<size_t> skylineProfile() const override
+    {
+      if (m_fa->bandwidth() == 0) return m_fb->skylineProfile();
+      if (m_fb->bandwidth() == 0) return m_fa->skylineProfile();
+      return { };
+    }
+    bool evaluateSkylineDeriv (VectorView<double> x, SkylineMatrix & df) const override
+    {
+      Vector<> tmp(m_fb->dimF());
+      Vector<> diag(m_fb->dimF());
+      m_fb->evaluate (x, tmp);
+      if (m_fa->bandwidth() == 0 && m_fa->evaluateDiagDeriv(tmp, diag))
+        {
+          if (!m_fb->evaluateSkylineDeriv(x, df)) return false;
+          df.scaleRows(diag);
+          return true;
+        }
+      if (m_fb->bandwidth() == 0 && m_fb->evaluateDiagDeriv(x, diag))
+        {
+          bool zero = true;
+          for (size_t j = 0; j < diag.size(); j++)
+            if (diag(j) != 0) zero = false;
+          if (zero)
+            {
+              df.setZero();
+              return true;
+            }
+          if (!m_fa->evaluateSkylineDeriv(tmp, df)) return false;
+          df.scaleCols(diag);
+          return true;
+        }
+      return false;
+    }
   };
 
 
@@ -241,6 +540,17 @@ namespace ASC_ode
       df = 0.0;
       df.diag().range(m_first, m_next) = 1;
     }
+    bool evaluateDiagDeriv (VectorView<double> x, VectorView<double> d) const override
+    {
+      d = 0.0;
+      d.range(m_first, m_next) = 1;
+      return true;
+    }
+    size_t bandwidth() const override { return 0; }
+    bool evaluateBandDeriv (VectorView<double> x, BandMatrix & df) const override
+    {
+      return DiagToBand(*this, x, df);
+    }
   };
 
 
@@ -0,0 +1,182 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX__) || defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace ASC_ode
+{
+
+  // number of doubles processed together on this machine
+#if defined(__AVX512F__)
+  constexpr size_t SIMD_DOUBLE_WIDTH = 8;
+#elif defined(__AVX__)
+  constexpr size_t SIMD_DOUBLE_WIDTH = 4;
+#else
+  constexpr size_t SIMD_DOUBLE_WIDTH = 4;
+#endif
+  // floats fill the same registers with twice as many lanes
+  constexpr size_t SIMD_FLOAT_WIDTH = 2*SIMD_DOUBLE_WIDTH;
+
+
+  // N lanes of T. The generic version is a plain array with lane loops,
+  // which the compiler vectorizes where it can. AVX and AVX-512
+  // specializations for double (and AVX for float) follow below.
+  template <typename T, size_t N = SIMD_DOUBLE_WIDTH>
+  class SIMD
+  {
+    T m_val[N];
+  public:
+    SIMD () = default;
+    SIMD (T v) { for (size_t i = 0; i < N; i++) m_val[i] = v; }
+
+    static constexpr size_t size() { return N; }
+    T operator[] (size_t i) const { return m_val[i]; }
+    T & operator[] (size_t i) { return m_val[i]; }
+
+    static SIMD load (const T * p)
+    {
+      SIMD r;
+      for (size_t i = 0; i < N; i++) r.m_val[i] = p[i];
+      return r;
+    }
+    // base[idx[i]]
+    static SIMD gather (const T * base, const size_t * idx)
+    {
+      SIMD r;
+      for (size_t i = 0; i < N; i++) r.m_val[i] = base[idx[i]];
+      return r;
+    }
+    void store (T * p) const { for (size_t i = 0; i < N; i++) p[i] = m_val[i]; }
+  };
+
+  template <typename T, size_t N>
+  SIMD<T,N> operator+ (SIMD<T,N> a, SIMD<T,N> b)
+  { SIMD<T,N> r; for (size_t i = 0; i < N; i++) r[i] = a[i]+b[i]; return r; }
+  template <typename T, size_t N>
+  SIMD<T,N> operator- (SIMD<T,N> a, SIMD<T,N> b)
+  { SIMD<T,N> r; for (size_t i = 0; i < N; i++) r[i] = a[i]-b[i]; return r; }
+  template <typename T, size_t N>
+  SIMD<T,N> operator* (SIMD<T,N> a, SIMD<T,N> b)
+  { SIMD<T,N> r; for (size_t i = 0; i < N; i++) r[i] = a[i]*b[i]; return r; }
+  template <typename T, size_t N>
+  SIMD<T,N> operator/ (SIMD<T,N> a, SIMD<T,N> b)
+  { SIMD<T,N> r; for (size_t i = 0; i < N; i++) r[i] = a[i]/b[i]; return r; }
+  template <typename T, size_t N>
+  SIMD<T,N> sqrt (SIMD<T,N> a)
+  {
+    using std::sqrt;   // or sqrt of the lane type, e.g. AutoDiff
+    SIMD<T,N> r; for (size_t i = 0; i < N; i++) r[i] = sqrt(a[i]); return r;
+  }
+
+
+
+#if defined(__AVX__)
+  template <>
+  class SIMD<double,4>
+  {
+    __m256d m_val;
+  public:
+    SIMD () = default;
+    SIMD (double v) : m_val(_mm256_set1_pd(v)) { }
+    SIMD (__m256d v) : m_val(v) { }
+
+    static constexpr size_t size() { return 4; }
+    __m256d val() const { return m_val; }
+    double operator[] (size_t i) const { return ((const double*)&m_val)[i]; }
+    double & operator[] (size_t i) { return ((double*)&m_val)[i]; }
+
+    static SIMD load (const double * p) { return _mm256_loadu_pd(p); }
+    static SIMD gather (const double * base, const size_t * idx)
+    {
+#if defined(__AVX2__)
+      return _mm256_i64gather_pd(base, _mm256_loadu_si256((const __m256i*)idx), 8);
+#else
+      return _mm256_set_pd(base[idx[3]], base[idx[2]], base[idx[1]], base[idx[0]]);
+#endif
+    }
+    void store (double * p) const { _mm256_storeu_pd(p, m_val); }
+  };
+
+  inline SIMD<double,4> operator+ (SIMD<double,4> a, SIMD<double,4> b) { return _mm256_add_pd(a.val(), b.val()); }
+  inline SIMD<double,4> operator- (SIMD<double,4> a, SIMD<double,4> b) { return _mm256_sub_pd(a.val(), b.val()); }
+  inline SIMD<double,4> operator* (SIMD<double,4> a, SIMD<double,4> b) { return _mm256_mul_pd(a.val(), b.val()); }
+  inline SIMD<double,4> operator/ (SIMD<double,4> a, SIMD<double,4> b) { return _mm256_div_pd(a.val(), b.val()); }
+  inline SIMD<double,4> sqrt (SIMD<double,4> a) { return _mm256_sqrt_pd(a.val()); }
+
+
+  template <>
+  class SIMD<float,8>
+  {
+    __m256 m_val;
+  public:
+    SIMD () = default;
+    SIMD (float v) : m_val(_mm256_set1_ps(v)) { }
+    SIMD (__m256 v) : m_val(v) { }
+
+    static constexpr size_t size() { return 8; }
+    __m256 val() const { return m_val; }
+    float operator[] (size_t i) const { return ((const float*)&m_val)[i]; }
+    float & operator[] (size_t i) { return ((float*)&m_val)[i]; }
+
+    static SIMD load (const float * p) { return _mm256_loadu_ps(p); }
+    static SIMD gather (const float * base, const size_t * idx)
+    {
+#if defined(__AVX2__)
+      // 64 bit indices, four lanes per gather
+      __m128 lo = _mm256_i64gather_ps(base, _mm256_loadu_si256((const __m256i*)idx), 4);
+      __m128 hi = _mm256_i64gather_ps(base, _mm256_loadu_si256((const __m256i*)(idx+4)), 4);
+      return _mm256_set_m128(hi, lo);
+#else
+      return _mm256_set_ps(base[idx[7]], base[idx[6]], base[idx[5]], base[idx[4]],
+                           base[idx[3]], base[idx[2]], base[idx[1]], base[idx[0]]);
+#endif
+    }
+    void store (float * p) const { _mm256_storeu_ps(p, m_val); }
+  };
+
+  inline SIMD<float,8> operator+ (SIMD<float,8> a, SIMD<float,8> b) { return _mm256_add_ps(a.val(), b.val()); }
+  inline SIMD<float,8> operator- (SIMD<float,8> a, SIMD<float,8> b) { return _mm256_sub_ps(a.val(), b.val()); }
+  inline SIMD<float,8> operator* (SIMD<float,8> a, SIMD<float,8> b) { return _mm256_mul_ps(a.val(), b.val()); }
+  inline SIMD<float,8> operator/ (SIMD<float,8> a, SIMD<float,8> b) { return _mm256_div_ps(a.val(), b.val()); }
+  inline SIMD<float,8> sqrt (SIMD<float,8> a) { return _mm256_sqrt_ps(a.val()); }
+#endif
+
+
+#if defined(__AVX512F__)
+  template <>
+  class SIMD<double,8>
+  {
+    __m512d m_val;
+  public:
+    SIMD () = default;
+    SIMD (double v) : m_val(_mm512_set1_pd(v)) { }
+    SIMD (__m512d v) : m_val(v) { }
+
+    static constexpr size_t size() { return 8; }
+    __m512d val() const { return m_val; }
+    double operator[] (size_t i) const { return ((const double*)&m_val)[i]; }
+    double & operator[] (size_t i) { return ((double*)&m_val)[i]; }
+
+    static SIMD load (const double * p) { return _mm512_loadu_pd(p); }
+    static SIMD gather (const double * base, const size_t * idx)
+    {
+      return _mm512_i64gather_pd(_mm512_loadu_si512(idx), base, 8);
+    }
+    void store (double * p) const { _mm512_storeu_pd(p, m_val); }
+  };
+
+  inline SIMD<double,8> operator+ (SIMD<double,8> a, SIMD<double,8> b) { return _mm512_add_pd(a.val(), b.val()); }
+  inline SIMD<double,8> operator- (SIMD<double,8> a, SIMD<double,8> b) { return _mm512_sub_pd(a.val(), b.val()); }
+  inline SIMD<double,8> operator* (SIMD<double,8> a, SIMD<double,8> b) { return _mm512_mul_pd(a.val(), b.val()); }
+  inline SIMD<double,8> operator/ (SIMD<double,8> a, SIMD<double,8> b) { return _mm512_div_pd(a.val(), b.val()); }
+  inline SIMD<double,8> sqrt (SIMD<double,8> a) { return _mm512_sqrt_pd(a.val()); }
+#endif
+
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SKYLINEMATRIX_HPP
+#define SKYLINEMATRIX_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <vector.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // n x n matrix with a symmetric profile (envelope): row i has entries in
+  // the columns [firstcol[i], i], column i in the rows [firstcol[i], i].
+  // LU without pivoting keeps all fill-in inside the profile, so the
+  // profile is the complete symbolic factorization. Unlike the band, the
+  // profile follows the rows, a few long couplings don't widen all rows.
+  class SkylineMatrix
+  {
+    size_t m_n;
+    std::vector<size_t> m_firstcol, m_offset;
+    std::vector<double> m_lower;   // row i:    (i, firstcol[i] ... i-1)
+    std::vector<double> m_upper;   // column i: (firstcol[i] ... i-1, i)
+    std::vector<double> m_diag;
+  public:
+    // firstcol[i] <= i
+    SkylineMatrix (std::vector<size_t> firstcol)
+      : m_n(firstcol.size()), m_firstcol(std::move(firstcol)), m_offset(m_n+1, 0), m_diag(m_n, 0.0)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        m_offset[i+1] = m_offset[i] + (i - m_firstcol[i]);
+      m_lower.assign(m_offset[m_n], 0.0);
+      m_upper.assign(m_offset[m_n], 0.0);
+    }
+
+    size_t size() const { return m_n; }
+    size_t firstCol (size_t i) const { return m_firstcol[i]; }
+    const std::vector<size_t> & profile() const { return m_firstcol; }
+    // number of stored entries
+    size_t profileSize() const { return m_n + 2*m_offset[m_n]; }
+
+    bool inProfile (size_t i, size_t j) const
+    { return i < m_n && j < m_n && std::min(i,j) >= m_firstcol[std::max(i,j)]; }
+
+    double & operator() (size_t i, size_t j)
+    {
+      if (i == j) return m_diag[i];
+      if (j < i) return m_lower[m_offset[i] + j-m_firstcol[i]];
+      return m_upper[m_offset[j] + i-m_firstcol[j]];
+    }
+    double operator() (size_t i, size_t j) const
+    { return const_cast<SkylineMatrix&>(*this)(i,j); }
+
+    void setZero ()
+    {
+      std::fill(m_lower.begin(), m_lower.end(), 0.0);
+      std::fill(m_upper.begin(), m_upper.end(), 0.0);
+      std::fill(m_diag.begin(), m_diag.end(), 0.0);
+    }
+
+    SkylineMatrix & operator*= (double s)
+    {
+      for (auto & v : m_lower) v *= s;
+      for (auto & v : m_upper) v *= s;
+      for (auto & v : m_diag) v *= s;
+      return *this;
+    }
+
+    // this += s * b, b with the same profile
+    void add (double s, const SkylineMatrix & b)
+    {
+      for (size_t k = 0; k < m_lower.size(); k++)
+        {
+          m_lower[k] += s * b.m_lower[k];
+          m_upper[k] += s * b.m_upper[k];
+        }
+      for (size_t i = 0; i < m_n; i++)
+        m_diag[i] += s * b.m_diag[i];
+    }
+
+    void scaleRows (VectorView<double> d)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        {
+          m_diag[i] *= d(i);
+          for (size_t j = m_firstcol[i]; j < i; j++)
+            {
+              (*this)(i,j) *= d(i);
+              (*this)(j,i) *= d(j);
+            }
+        }
+    }
+
+    void scaleCols (VectorView<double> d)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        {
+          m_diag[i] *= d(i);
+          for (size_t j = m_firstcol[i]; j < i; j++)
+            {
+              (*this)(i,j) *= d(j);
+              (*this)(j,i) *= d(i);
+            }
+        }
+    }
+
+    // y = A x, only before factor
+    void mult (VectorView<double> x, VectorView<double> y) const
+    {
+      for (size_t i = 0; i < m_n; i++)
+        y(i) = m_diag[i] * x(i);
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t j = m_firstcol[i]; j < i; j++)
+          {
+            y(i) += (*this)(i,j) * x(j);
+            y(j) += (*this)(j,i) * x(i);
+          }
+    }
+
+    // in place LU (Crout, row i of L and column i of U per step),
+    // no pivoting: for diagonally dominant or definite matrices
+    void factor ()
+    {
+      for (size_t i = 0; i < m_n; i++)
+        {
+          size_t fi = m_firstcol[i];
+          double * li = m_lower.data() + m_offset[i] - fi;   // li[j] = L(i,j)
+          double * ui = m_upper.data() + m_offset[i] - fi;   // ui[j] = U(j,i)
+
+          for (size_t j = fi; j < i; j++)
+            {
+              size_t k0 = std::max(fi, m_firstcol[j]);
+              const double * lj = m_lower.data() + m_offset[j] - m_firstcol[j];
+              const double * uj = m_upper.data() + m_offset[j] - m_firstcol[j];
+              double sl = li[j], su = ui[j];
+              for (size_t k = k0; k < j; k++)
+                {
+                  sl -= li[k] * uj[k];
+                  su -= lj[k] * ui[k];
+                }
+              li[j] = sl / m_diag[j];
+              ui[j] = su;
+            }
+
+          double d = m_diag[i];
+          for (size_t k = fi; k < i; k++)
+            d -= li[k] * ui[k];
+          if (d == 0)
+            throw std::domain_error("SkylineMatrix::factor: zero pivot");
+          m_diag[i] = d;
+        }
+    }
+
+    // solves A x = b with the factors, b is overwritten by x
+    void solve (VectorView<double> b) const
+    {
+      for (size_t i = 0; i < m_n; i++)
+        {
+          const double * li = m_lower.data() + m_offset[i] - m_firstcol[i];
+          double sum = b(i);
+          for (size_t k = m_firstcol[i]; k < i; k++)
+            sum -= li[k] * b(k);
+          b(i) = sum;
+        }
+      for (size_t i = m_n; i-- > 0; )
+        {
+          const double * ui = m_upper.data() + m_offset[i] - m_firstcol[i];
+          b(i) /= m_diag[i];
+          for (size_t j = m_firstcol[i]; j < i; j++)
+            b(j) -= ui[j] * b(i);
+        }
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef SPARSE_AUTODIFF_HPP
+#define SPARSE_AUTODIFF_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+#include "nonlinfunc.hpp"
+#include "sparsematrix.hpp"
+
+
+namespace ASC_ode
+{
+
+  // Nonzero derivatives of a SparseAutoDiff, sorted by index. Up to NB
+  // entries live inline, more move to the heap. A spring force or a
+  // stencil only depends on a few unknowns, so usually nothing is allocated.
+  template <typename T, size_t NB>
+  class SparseDerivs
+  {
+    size_t m_size = 0;
+    size_t m_inlidx[NB];
+    T m_inlval[NB];
+    std::vector<size_t> m_heapidx;
+    std::vector<T> m_heapval;
+
+    bool onHeap() const { return m_size > NB; }
+  public:
+    size_t size() const { return m_size; }
+    const size_t * indices() const { return onHeap() ? m_heapidx.data() : m_inlidx; }
+    const T * values() const { return onHeap() ? m_heapval.data() : m_inlval; }
+    T * values() { return onHeap() ? m_heapval.data() : m_inlval; }
+    size_t index (size_t k) const { return indices()[k]; }
+    T value (size_t k) const { return values()[k]; }
+
+    // derivative by unknown i, 0 if not present
+    T operator[] (size_t i) const
+    {
+      const size_t * idx = indices();
+      const size_t * pos = std::lower_bound(idx, idx+m_size, i);
+      return (pos != idx+m_size && *pos == i) ? values()[pos-idx] : T(0);
+    }
+
+    void clear ()
+    {
+      m_size = 0;
+      m_heapidx.clear();
+      m_heapval.clear();
+    }
+
+    // indices must come in increasing order
+    void append (size_t i, T v)
+    {
+      if (m_size < NB)
+        {
+          m_inlidx[m_size] = i;
+          m_inlval[m_size] = v;
+        }
+      else
+        {
+          if (m_size == NB)
+            {
+              m_heapidx.assign(m_inlidx, m_inlidx+NB);
+              m_heapval.assign(m_inlval, m_inlval+NB);
+            }
+          m_heapidx.push_back(i);
+          m_heapval.push_back(v);
+        }
+      m_size++;
+    }
+  };
+
+  // r = ca * a + cb * b, merging the sorted index lists
+  template <typename T, size_t NB>
+  void SparseCombine (SparseDerivs<T,NB> & r, T ca, const SparseDerivs<T,NB> & a,
+                      T cb, const SparseDerivs<T,NB> & b)
+  {
+    r.clear();
+    const size_t * ia = a.indices(), * ib = b.indices();
+    const T * va = a.values(), * vb = b.values();
+    size_t ka = 0, kb = 0;
+    while (ka < a.size() && kb < b.size())
+      {
+        if (ia[ka] < ib[kb])
+          { r.append(ia[ka], ca*va[ka]); ka++; }
+        else if (ib[kb] < ia[ka])
+          { r.append(ib[kb], cb*vb[kb]); kb++; }
+        else
+          { r.append(ia[ka], ca*va[ka] + cb*vb[kb]); ka++; kb++; }
+      }
+    for ( ; ka < a.size(); ka++) r.append(ia[ka], ca*va[ka]);
+    for ( ; kb < b.size(); kb++) r.append(ib[kb], cb*vb[kb]);
+  }
+
+
+  // Forward AutoDiff with a runtime number of unknowns, only the nonzero
+  // derivatives are stored. The costs of an operation are proportional to
+  // the nonzeros of its operands, not to the number of unknowns, which
+  // makes it fit for Jacobians of large, sparsely coupled systems.
+  // Structural zeros (e.g. x-x) are kept, so the pattern does not depend
+  // on the values.
+  template <typename T = double, size_t NB = 8>
+  class SparseAutoDiff
+  {
+    T m_val;
+    SparseDerivs<T,NB> m_deriv;
+  public:
+    SparseAutoDiff () : m_val(0) { }
+    SparseAutoDiff (T v) : m_val(v) { }
+    // the unknown number index with value v
+    SparseAutoDiff (T v, size_t index) : m_val(v) { m_deriv.append(index, T(1)); }
+
+    T value() const { return m_val; }
+    SparseDerivs<T,NB> & deriv() { return m_deriv; }
+    const SparseDerivs<T,NB> & deriv() const { return m_deriv; }
+
+    // value v with derivatives ca * a' + cb * b'
+    static SparseAutoDiff combine (T v, T ca, const SparseAutoDiff & a, T cb, const SparseAutoDiff & b)
+    {
+      SparseAutoDiff r(v);
+      SparseCombine(r.m_deriv, ca, a.m_deriv, cb, b.m_deriv);
+      return r;
+    }
+
+    // value v with derivatives c * a'
+    static SparseAutoDiff scale (T v, T c, const SparseAutoDiff & a)
+    {
+      SparseAutoDiff r(a);
+      r.m_val = v;
+      T * vals = r.m_deriv.values();
+      for (size_t k = 0; k < r.m_deriv.size(); k++)
+        vals[k] *= c;
+      return r;
+    }
+  };
+
+
+  template <typename T, size_t NB>
+  std::ostream & operator<< (std::ostream & os, const SparseAutoDiff<T,NB> & ad)
+  {
+    os << "Value: " << ad.value() << ", Deriv: [";
+    for (size_t k = 0; k < ad.deriv().size(); k++)
+      {
+        os << ad.deriv().index(k) << ": " << ad.deriv().value(k);
+        if (k+1 < ad.deriv().size()) os << ", ";
+      }
+    os << "]";
+    return os;
+  }
+
+
+  template <typename T, size_t NB>
+  auto operator+ (const SparseAutoDiff<T,NB> & a, const SparseAutoDiff<T,NB> & b)
+  { return SparseAutoDiff<T,NB>::combine(a.value()+b.value(), T(1), a, T(1), b); }
+
+  template <typename T, size_t NB>
+  auto operator- (const SparseAutoDiff<T,NB> & a, const SparseAutoDiff<T,NB> & b)
+  { return SparseAutoDiff<T,NB>::combine(a.value()-b.value(), T(1), a, T(-1), b); }
+
+  template <typename T, size_t NB>
+  auto operator* (const SparseAutoDiff<T,NB> & a, const SparseAutoDiff<T,NB> & b)
+  { return SparseAutoDiff<T,NB>::combine(a.value()*b.value(), b.value(), a, a.value(), b); }
+
+  template <typename T, size_t NB>
+  auto operator/ (const SparseAutoDiff<T,NB> & a, const SparseAutoDiff<T,NB> & b)
+  {
+    T inv_b = T(1) / b.value();
+    return SparseAutoDiff<T,NB>::combine(a.value()/b.value(), inv_b, a, -a.value()*inv_b*inv_b, b);
+  }
+
+  template <typename T, size_t NB>
+  auto operator- (const SparseAutoDiff<T,NB> & a)
+  { return SparseAutoDiff<T,NB>::scale(-a.value(), T(-1), a); }
+
+  // with constants
+  template <typename T, size_t NB>
+  auto operator+ (const SparseAutoDiff<T,NB> & a, std::type_identity_t<T> s)
+  { return SparseAutoDiff<T,NB>::scale(a.value()+s, T(1), a); }
+  template <typename T, size_t NB>
+  auto operator+ (std::type_identity_t<T> s, const SparseAutoDiff<T,NB> & a) { return a + s; }
+
+  template <typename T, size_t NB>
+  auto operator- (const SparseAutoDiff<T,NB> & a, std::type_identity_t<T> s)
+  { return SparseAutoDiff<T,NB>::scale(a.value()-s, T(1), a); }
+  template <typename T, size_t NB>
+  auto operator- (std::type_identity_t<T> s, const SparseAutoDiff<T,NB> & a)
+  { return SparseAutoDiff<T,NB>::scale(s-a.value(), T(-1), a); }
+
+  template <typename T, size_t NB>
+  auto operator* (const SparseAutoDiff<T,NB> & a, std::type_identity_t<T> s)
+  { return SparseAutoDiff<T,NB>::scale(a.value()*s, s, a); }
+  template <typename T, size_t NB>
+  auto operator* (std::type_identity_t<T> s, const SparseAutoDiff<T,NB> & a) { return a * s; }
+
+  template <typename T, size_t NB>
+  auto operator/ (const SparseAutoDiff<T,NB> & a, std::type_identity_t<T> s)
+  { return SparseAutoDiff<T,NB>::scale(a.value()/s, T(1)/s, a); }
+  template <typename T, size_t NB>
+  auto operator/ (std::type_identity_t<T> s, const SparseAutoDiff<T,NB> & a)
+  { return SparseAutoDiff<T,NB>::scale(s/a.value(), -s/(a.value()*a.value()), a); }
+
+  template <typename T, size_t NB>
+  SparseAutoDiff<T,NB> & operator+= (SparseAutoDiff<T,NB> & a, const SparseAutoDiff<T,NB> & b)
+  {
+    a = a + b;
+    return a;
+  }
+
+  template <typename T, size_t NB>
+  SparseAutoDiff<T,NB> & operator-= (SparseAutoDiff<T,NB> & a, const SparseAutoDiff<T,NB> & b)
+  {
+    a = a - b;
+    return a;
+  }
+
+
+  template <typename T, size_t NB>
+  auto sin (const SparseAutoDiff<T,NB> & a)
+  {
+    using std::sin, std::cos;
+    return SparseAutoDiff<T,NB>::scale(sin(a.value()), cos(a.value()), a);
+  }
+
+  template <typename T, size_t NB>
+  auto cos (const SparseAutoDiff<T,NB> & a)
+  {
+    using std::sin, std::cos;
+    return SparseAutoDiff<T,NB>::scale(cos(a.value()), -sin(a.value()), a);
+  }
+
+  template <typename T, size_t NB>
+  auto exp (const SparseAutoDiff<T,NB> & a)
+  {
+    using std::exp;
+    T val = exp(a.value());
+    return SparseAutoDiff<T,NB>::scale(val, val, a);
+  }
+
+  template <typename T, size_t NB>
+  auto log (const SparseAutoDiff<T,NB> & a)
+  {
+    using std::log;
+    return SparseAutoDiff<T,NB>::scale(log(a.value()), T(1)/a.value(), a);
+  }
+
+  template <typename T, size_t NB>
+  auto sqrt (const SparseAutoDiff<T,NB> & a)
+  {
+    using std::sqrt;
+    T val = sqrt(a.value());
+    return SparseAutoDiff<T,NB>::scale(val, T(1)/(2*val), a);
+  }
+
+
+
+  // Jacobian by SparseAutoDiff of a function class F providing
+  //   dimX(), dimF() and  template <typename T> T_evaluate (VectorView<T> x, VectorView<T> f)
+  // (as PendulumAD). One evaluation in SparseAutoDiff gives all rows,
+  // evaluateSparseDeriv returns them in compressed row storage.
+  template <typename F, size_t NB = 8>
+  class SparseADFunction : public NonlinearFunction
+  {
+    using SAD = SparseAutoDiff<double,NB>;
+    std::shared_ptr<F> m_func;
+    mutable Vector<SAD> m_x, m_f;
+
+    void evaluateAD (VectorView<double> x) const
+    {
+      for (size_t i = 0; i < dimX(); i++)
+        m_x(i) = SAD(x(i), i);
+      m_func->template T_evaluate<SAD>(m_x, m_f);
+    }
+  public:
+    SparseADFunction (std::shared_ptr<F> func)
+      : m_func(func), m_x(func->dimX()), m_f(func->dimF()) { }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimF(); }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      m_func->template T_evaluate<double>(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      evaluateAD(x);
+      df = 0.0;
+      for (size_t i = 0; i < dimF(); i++)
+        {
+          auto & d = m_f(i).deriv();
+          for (size_t k = 0; k < d.size(); k++)
+            df(i, d.index(k)) = d.value(k);
+        }
+    }
+
+    // df = the Jacobian, also the values of f
+    void evaluateSparseDeriv (VectorView<double> x, VectorView<double> f, SparseMatrix & df) const
+    {
+      evaluateAD(x);
+      df.clear(dimX());
+      for (size_t i = 0; i < dimF(); i++)
+        {
+          f(i) = m_f(i).value();
+          auto & d = m_f(i).deriv();
+          df.appendRow();
+          for (size_t k = 0; k < d.size(); k++)
+            df.add(d.index(k), d.value(k));
+        }
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef SPARSEMATRIX_HPP
+#define SPARSEMATRIX_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <vector.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // compressed row storage, filled row by row:
+  //   A.clear(width); A.appendRow(); A.add(col, val); ...
+  // clear keeps the capacity, so refilling in every Newton step does not allocate
+  class SparseMatrix
+  {
+    size_t m_width = 0;
+    std::vector<size_t> m_firstinrow { 0 };
+    std::vector<size_t> m_colind;
+    std::vector<double> m_vals;
+  public:
+    SparseMatrix (size_t width = 0) : m_width(width) { }
+
+    size_t rows() const { return m_firstinrow.size()-1; }
+    size_t cols() const { return m_width; }
+    size_t nnz() const { return m_colind.size(); }
+
+    void clear (size_t width)
+    {
+      m_width = width;
+      m_firstinrow.resize(1);
+      m_colind.clear();
+      m_vals.clear();
+    }
+
+    size_t appendRow ()
+    {
+      m_firstinrow.push_back(m_colind.size());
+      return rows()-1;
+    }
+
+    // add an entry to the last row
+    void add (size_t col, double val)
+    {
+      m_colind.push_back(col);
+      m_vals.push_back(val);
+      m_firstinrow.back()++;
+    }
+
+    size_t firstInRow (size_t i) const { return m_firstinrow[i]; }
+    size_t colIndex (size_t k) const { return m_colind[k]; }
+    double value (size_t k) const { return m_vals[k]; }
+    double & value (size_t k) { return m_vals[k]; }
+
+    // y = A x
+    void mult (VectorView<double> x, VectorView<double> y) const
+    {
+      for (size_t i = 0; i < rows(); i++)
+        {
+          double sum = 0;
+          for (size_t k = m_firstinrow[i]; k < m_firstinrow[i+1]; k++)
+            sum += m_vals[k] * x(m_colind[k]);
+          y(i) = sum;
+        }
+    }
+
+    // y = A^T x
+    void multTrans (VectorView<double> x, VectorView<double> y) const
+    {
+      y = 0.0;
+      for (size_t i = 0; i < rows(); i++)
+        for (size_t k = m_firstinrow[i]; k < m_firstinrow[i+1]; k++)
+          y(m_colind[k]) += m_vals[k] * x(i);
+    }
+  };
+
+}
+
+#endif
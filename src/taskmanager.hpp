@@ -0,0 +1,237 @@
+#ifndef TASKMANAGER_HPP
+#define TASKMANAGER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ASC_ode
+{
+
+  // Persistent pool of worker threads, started on first use.
+  // The calling thread takes part in the work as thread 0.
+  class TaskManager
+  {
+    std::vector<std::thread> m_workers;
+    std::mutex m_runmutex;    // one job at a time
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup, m_finished;
+
+    const std::function<void(size_t,size_t)> * m_job = nullptr;
+    size_t m_ntasks = 0;
+    std::atomic<size_t> m_nexttask { 0 };
+    size_t m_generation = 0;
+    size_t m_busy = 0;
+    bool m_stop = false;
+
+    static bool & insideJob()
+    {
+      thread_local bool inside = false;
+      return inside;
+    }
+
+    void work (size_t thread)
+    {
+      insideJob() = true;
+      for (size_t task = m_nexttask++; task < m_ntasks; task = m_nexttask++)
+        (*m_job)(task, thread);
+      insideJob() = false;
+    }
+
+    void workerLoop (size_t thread)
+    {
+      size_t generation = 0;
+      while (true)
+        {
+          {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [&] { return m_stop || m_generation != generation; });
+            if (m_stop) return;
+            generation = m_generation;
+          }
+          work(thread);
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_busy == 0)
+              m_finished.notify_one();
+          }
+        }
+    }
+
+  public:
+    TaskManager (size_t nthreads = std::thread::hardware_concurrency())
+    {
+      for (size_t i = 1; i < std::max<size_t>(nthreads, 1); i++)
+        m_workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~TaskManager ()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_wakeup.notify_all();
+      for (auto & t : m_workers)
+        t.join();
+    }
+
+    // number of threads from ASC_NUM_THREADS (1...1024), default all
+    // cores; invalid values fall back to the default
+    static size_t defaultThreads()
+    {
+      size_t hw = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+      const char * env = std::getenv("ASC_NUM_THREADS");
+      if (!env) return hw;
+      char * end;
+      long n = std::strtol(env, &end, 10);
+      if (end == env || *end != '\0' || n < 1 || n > 1024) return hw;
+      return size_t(n);
+    }
+
+    static TaskManager & instance()
+    {
+      static TaskManager tm(defaultThreads());
+      return tm;
+    }
+
+    size_t numThreads() const { return m_workers.size()+1; }
+
+    // calls f(task, thread) for all tasks in [0,ntasks).
+    // Nested calls from inside a job run serially on the calling thread.
+    void run (size_t ntasks, const std::function<void(size_t,size_t)> & f)
+    {
+      if (m_workers.empty() || ntasks <= 1 || insideJob())
+        {
+          for (size_t task = 0; task < ntasks; task++)
+            f(task, 0);
+          return;
+        }
+
+      std::lock_guard<std::mutex> runlock(m_runmutex);
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &f;
+        m_ntasks = ntasks;
+        m_nexttask = 0;
+        m_busy = m_workers.size();
+        m_generation++;
+      }
+      m_wakeup.notify_all();
+
+      work(0);
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_finished.wait(lock, [&] { return m_busy == 0; });
+      m_job = nullptr;
+    }
+
+    // Calls f(task, thread) for all tasks in [0,ntasks) by work stealing:
+    // every thread starts on its own contiguous block of tasks and, when
+    // that is done, steals the back half of the largest remaining block.
+    // Meant for few, coarse tasks of varying cost, e.g. whole simulations.
+    void runStealing (size_t ntasks, const std::function<void(size_t,size_t)> & f)
+    {
+      size_t nblocks = std::min(numThreads(), ntasks);
+      if (nblocks <= 1 || insideJob())
+        {
+          for (size_t task = 0; task < ntasks; task++)
+            f(task, 0);
+          return;
+        }
+
+      struct Block
+      {
+        std::mutex mutex;
+        size_t first, next;
+      };
+      std::unique_ptr<Block[]> blocks(new Block[nblocks]);
+      for (size_t b = 0; b < nblocks; b++)
+        {
+          blocks[b].first = b*ntasks / nblocks;
+          blocks[b].next = (b+1)*ntasks / nblocks;
+        }
+
+      run(nblocks, [&] (size_t b, size_t thread)
+      {
+        Block & own = blocks[b];
+        while (true)
+          {
+            size_t task = ntasks;
+            {
+              std::lock_guard<std::mutex> lock(own.mutex);
+              if (own.first < own.next)
+                task = own.first++;
+            }
+            if (task < ntasks)
+              {
+                f(task, thread);
+                continue;
+              }
+
+            // steal from the block with most tasks left
+            size_t victim = nblocks, most = 0;
+            for (size_t v = 0; v < nblocks; v++)
+              {
+                std::lock_guard<std::mutex> lock(blocks[v].mutex);
+                if (blocks[v].next - blocks[v].first > most)
+                  {
+                    most = blocks[v].next - blocks[v].first;
+                    victim = v;
+                  }
+              }
+            if (victim == nblocks) return;
+
+            size_t first, next;
+            {
+              std::lock_guard<std::mutex> lock(blocks[victim].mutex);
+              Block & vb = blocks[victim];
+              if (vb.first >= vb.next) continue;   // emptied meanwhile, search again
+              next = vb.next;
+              first = vb.first + (vb.next - vb.first) / 2;
+              vb.next = first;
+            }
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.first = first;
+            own.next = next;
+          }
+      });
+    }
+  };
+
+
+  // f(first, next) for chunks [first,next) of [0,n) with at most grainsize entries
+  template <typename F>
+  void ParallelForRange (size_t n, F f, size_t grainsize = 1024)
+  {
+    size_t ntasks = (n + grainsize-1) / grainsize;
+    TaskManager::instance().run(ntasks, [&] (size_t task, size_t)
+    {
+      f(task*grainsize, std::min(n, (task+1)*grainsize));
+    });
+  }
+
+
+  // f(i) for i in [0,n), in chunks of grainsize
+  template <typename F>
+  void ParallelFor (size_t n, F f, size_t grainsize = 1024)
+  {
+    size_t ntasks = (n + grainsize-1) / grainsize;
+    TaskManager::instance().run(ntasks, [&] (size_t task, size_t)
+    {
+      size_t last = std::min(n, (task+1)*grainsize);
+      for (size_t i = task*grainsize; i < last; i++)
+        f(i);
+    });
+  }
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef TAYLORSTEPPER_HPP
+#define TAYLORSTEPPER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "autodiff.hpp"
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  // Taylor series method for  y' = f(y)  with F providing
+  //   template <typename T> void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  // (as PendulumAD). The coefficients of the solution follow from
+  //   y_{k+1} = f(y)_k / (k+1),
+  // one T_evaluate in Taylor arithmetic per order. The intermediates of
+  // T_evaluate are not kept, pass k recomputes their coefficients up to
+  // degree k: a step costs O(p^3) per product in f, not the O(p^2) of a
+  // recorded, incrementally extended evaluation. Order and step size are
+  // chosen from the tolerance (Jorba, Zou 2005):
+  //   p = ceil(-ln(tol)/2 + 1),   h = min_{k=p-1,p} (1/|y_k|)^(1/k) / e^2
+  // with |y_k| relative to max(1,|y|). DoStep(tau) takes as many substeps
+  // as this step size needs to cover tau.
+  template <typename F, size_t PMAX = 30>
+  class TaylorStepper : public TimeStepper
+  {
+    using TS = Taylor<PMAX>;
+    std::shared_ptr<F> m_func;
+    size_t m_order;
+    size_t m_substeps = 0;
+    Vector<TS> m_x, m_f;
+  public:
+    TaylorStepper (std::shared_ptr<F> func, double tol = 1e-14)
+      : TimeStepper(func), m_func(func), m_x(func->dimX()), m_f(func->dimF())
+    {
+      m_order = std::clamp<size_t>(size_t(std::ceil(-0.5*std::log(tol) + 1)), 2, PMAX);
+    }
+
+    size_t order() const { return m_order; }
+    // substeps taken by all DoStep calls so far
+    size_t numSubsteps() const { return m_substeps; }
+
+    // coefficients y_0 ... y_p of the solution through y, stored in m_x,
+    // p evaluations of degree 0 ... p-1
+    void computeCoefficients (VectorView<double> y)
+    {
+      for (size_t i = 0; i < y.size(); i++)
+        {
+          m_x(i) = TS(y(i));
+          m_x(i).setDegree(m_order);
+        }
+      for (size_t k = 0; k < m_order; k++)
+        {
+          for (size_t i = 0; i < y.size(); i++)
+            m_x(i).setDegree(k);
+          m_func->template T_evaluate<TS>(m_x, m_f);
+          for (size_t i = 0; i < y.size(); i++)
+            m_x(i)[k+1] = m_f(i)[k] / double(k+1);
+        }
+      for (size_t i = 0; i < y.size(); i++)
+        m_x(i).setDegree(m_order);
+    }
+
+    // radius of convergence estimate from the last two coefficients
+    double stepSize (VectorView<double> y) const
+    {
+      double ynorm = 1;
+      for (size_t i = 0; i < y.size(); i++)
+        ynorm = std::max(ynorm, std::abs(y(i)));
+
+      double h = 1e300;
+      for (size_t k = m_order-1; k <= m_order; k++)
+        {
+          double ck = 0;
+          for (size_t i = 0; i < y.size(); i++)
+            ck = std::max(ck, std::abs(m_x(i)[k]));
+          if (ck > 0)
+            h = std::min(h, std::pow(ynorm/ck, 1.0/k));
+        }
+      return h / (M_E*M_E);
+    }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      double t = 0;
+      while (t < tau)
+        {
+          computeCoefficients(y);
+          double h = std::min(stepSize(y), tau-t);
+          if (tau-t-h < 1e-12*tau) h = tau-t;
+
+          for (size_t i = 0; i < y.size(); i++)
+            {
+              double sum = m_x(i)[m_order];
+              for (size_t k = m_order; k-- > 0; )
+                sum = sum*h + m_x(i)[k];
+              y(i) = sum;
+            }
+          t += h;
+          m_substeps++;
+        }
+    }
+  };
+
+}
+
+#endif
@@ -52,6 +52,25 @@ namespace ASC_ode {
       m_tau->set(tau);
       NewtonSolver(m_equ, y);
     }
+
+    // step of y and of its sensitivities dydp = dy/dp (dimX x P), staggered:
+    //   (I - tau f_y(ynew)) dydp_new = dydp + tau f_p(ynew)
+    // with the Jacobian of the step equation, factored once for all P columns
+    void DoStep(double tau, VectorView<double> y, MatrixView<double> dydp,
+                const ParameterDerivative & dfdp)
+    {
+      DoStep(tau, y);
+      Matrix<> fp(y.size(), dydp.cols());
+      dfdp(y, fp);
+      Linearization jac(m_equ, y);
+      Vector<> s(y.size());
+      for (size_t j = 0; j < dydp.cols(); j++)
+        {
+          s = dydp.col(j) + tau * fp.col(j);
+          jac.solve(s);
+          dydp.col(j) = s;
+        }
+    }
   };
 
   class ImprovedEuler : public TimeStepper
@@ -103,6 +122,33 @@ namespace ASC_ode {
 
     NewtonSolver(m_equ, y);
   }
+
+  // step of y and of its sensitivities dydp = dy/dp (dimX x P), staggered:
+  //   (I - tau/2 f_y(ynew)) dydp_new = dydp + tau/2 (f_y(yold) dydp + f_p(yold) + f_p(ynew))
+  void DoStep(double tau, VectorView<double> y, MatrixView<double> dydp,
+              const ParameterDerivative & dfdp)
+  {
+    Matrix<> fp(y.size(), dydp.cols());
+    dfdp(y, fp);
+    Linearization jacold(m_rhs, y);
+    Matrix<> rhs(y.size(), dydp.cols());
+    for (size_t j = 0; j < dydp.cols(); j++)
+      {
+        jacold.mult(dydp.col(j), rhs.col(j));
+        rhs.col(j) += fp.col(j);
+      }
+
+    DoStep(tau, y);
+    dfdp(y, fp);
+    Linearization jac(m_equ, y);
+    Vector<> s(y.size());
+    for (size_t j = 0; j < dydp.cols(); j++)
+      {
+        s = dydp.col(j) + (0.5*tau) * (rhs.col(j) + fp.col(j));
+        jac.solve(s);
+        dydp.col(j) = s;
+      }
+  }
   };
 
 